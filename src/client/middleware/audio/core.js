@@ -8,10 +8,11 @@ import {v4 as uuid} from "uuid";
 import {createAudioWorkletNode} from "./util";
 import s from "./state";
 import {getAudioBufferRMSImageURL} from "../../util";
+import {AUDIO_SAMPLE_RATE} from "../../../shared";
 
 window.audioState = s;
 
-const SAMPLE_RATE = 44100;
+const SAMPLE_RATE = AUDIO_SAMPLE_RATE;
 
 let scheduleUpcomingItems = () => {
     for (let [itemId, item] of Object.entries(s.items)) {
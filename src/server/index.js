@@ -1,4 +1,4 @@
-import {RTCTransceivers} from "../shared";
+import {RTCTransceivers, AUDIO_SAMPLE_RATE} from "../shared";
 import {v4 as uuid} from "uuid";
 import * as db from "./data";
 import {
@@ -49,6 +49,7 @@ let exportWav = (rawAudioFilePath) => {
     return new Promise((resolve, reject) => ffmpeg(rawAudioFilePath)
         // Extract the recorded audio from the video
         .inputFormat("f32le")
+        .inputOptions(["-ar", `${AUDIO_SAMPLE_RATE}`, "-ac", "1"])
         .output(rawAudioFilePath + ".wav")
         .on('error', reject)
         .on('end', resolve)
@@ -62,15 +63,71 @@ let exportWav = (rawAudioFilePath) => {
 //     process.exit(0);
 // });
 
-let align = (itemId) => {
+const ECHO_DIAGNOSTICS = !!process.env.ECHO_DIAGNOSTICS;
+// "fast", "balanced" or "best" - see EchoCancellerConfig::setPreset()
+const ECHO_PRESET = process.env.ECHO_PRESET || 'balanced';
+// Reference spectra shared between takes recorded against the same reference audio.  Off unless a directory is given,
+// since a minute of reference is ~170MB of spectra.  The least recently used files go once it's over ECHO_SPECTRA_MAX_MB.
+const ECHO_SPECTRA_DIR = process.env.ECHO_SPECTRA_DIR || '';
+const ECHO_SPECTRA_MAX_BYTES = (parseInt(process.env.ECHO_SPECTRA_MAX_MB) || 2048)*1024*1024;
+
+// Cancellers keep their FFT plans and buffers between takes.  One per libuv pool thread, so a burst of uploads still runs in parallel.
+let cancellerOptions = {sampleRate: AUDIO_SAMPLE_RATE, preset: ECHO_PRESET, diagnostics: ECHO_DIAGNOSTICS};
+if (ECHO_SPECTRA_DIR) cancellerOptions.speakerCache = ECHO_SPECTRA_DIR;
+let idleCancellers = Array.from({length: parseInt(process.env.UV_THREADPOOL_SIZE) || 4}, () => new echoCanceller.Canceller(cancellerOptions));
+let cancellerWaiters = [];
+let withCanceller = async (fn) => {
+    let canceller = idleCancellers.pop() || await new Promise(resolve => cancellerWaiters.push(resolve));
+    try {
+        return await fn(canceller);
+    } finally {
+        let next = cancellerWaiters.shift();
+        next ? next(canceller) : idleCancellers.push(canceller);
+    }
+}
+
+// The canceller touches a spectra file whenever it's reused, so the oldest modification times go first
+let pruneSpectra = () => {
+    if (!ECHO_SPECTRA_DIR) return;
+    let files;
+    try {
+        files = fs.readdirSync(ECHO_SPECTRA_DIR).filter(name => name.endsWith('.spectra')).map(name => {
+            let path = `${ECHO_SPECTRA_DIR}/${name}`;
+            let stats = fs.statSync(path);
+            return {path, size: stats.size, time: stats.mtimeMs};
+        });
+    } catch (e) {
+        log.warn("Failed to list spectra:", e);
+        return;
+    }
+    let total = files.reduce((sum, file) => sum + file.size, 0);
+    files.sort((a, b) => a.time - b.time);
+    for (let file of files) {
+        if (total <= ECHO_SPECTRA_MAX_BYTES) break;
+        tryDeleteFile(file.path);
+        total -= file.size;
+    }
+}
+
+let align = async (itemId) => {
     let micBuffer = fs.readFileSync(`.items/${itemId}.aud`)
     let recordedAudio = new Float32Array(micBuffer.buffer, 0, micBuffer.byteLength / 4);
     let referenceBuffer = fs.readFileSync(`.items/${itemId}.reference.aud`);
     let referenceAudio = new Float32Array(referenceBuffer.buffer, 0, referenceBuffer.byteLength / 4);
 
-    let offset = echoCanceller.cancel(referenceAudio.buffer, recordedAudio.buffer, itemId);
+    if (ECHO_SPECTRA_DIR) fs.mkdirSync(ECHO_SPECTRA_DIR, {recursive: true});
+
+    // Runs on the libuv thread pool, so other rooms keep going while this take is processed
+    let result = await withCanceller(canceller => canceller.cancelAsync(referenceAudio.buffer, recordedAudio.buffer));
+    let offset = result;
+    if (ECHO_DIAGNOSTICS) {
+        offset = result.offset;
+        // Raw f32le impulse, for inspecting the echo path of a take
+        fs.writeFile(`.items/${itemId}.impulse`, result.impulse, e => e && log.warn("Failed to write impulse:", e));
+    }
 
     fs.writeFileSync(`.items/${itemId}.cancelled.aud`, recordedAudio);
+    pruneSpectra();
 
     /*new Promise((resolve, reject) => ffmpeg(`.items/${itemId}.cancelled.aud`)
         .inputFormat("f32le")
@@ -390,7 +447,7 @@ let messageHandlers = {
             .noVideo()
             .format("f32le")
             .audioCodec("pcm_f32le")
-            .audioFrequency(44100)
+            .audioFrequency(AUDIO_SAMPLE_RATE) // No-op when the recording already matches the reference
             .audioChannels(1)
             // Strip the audio from the video
             .output(`.items/${itemId}.vid`)
@@ -401,7 +458,7 @@ let messageHandlers = {
             .on('end', resolve)
             .run());
 
-        let offset = align(itemId);
+        let offset = await align(itemId);
 
         await exportWav(`.items/${itemId}.aud`);
         await exportWav(`.items/${itemId}.cancelled.aud`);
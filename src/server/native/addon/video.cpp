@@ -1,4 +1,7 @@
 #include <napi.h>
+#include <cmath>
+
+#include "../echo-canceller/lib/convolution.h"
 
 
 void log(const Napi::Env env, const std::vector<std::string> msgs) {
@@ -10,13 +13,20 @@ void log(const Napi::Env env, const std::vector<std::string> msgs) {
     lg.Call(ags);
 }
 
+// align(recorded, reference, sampleRate = 44100)
 Napi::Number align(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
 
     auto recordedAudio = info[0].As<Napi::ArrayBuffer>();
     auto referenceAudio = info[1].As<Napi::ArrayBuffer>();
+    const double sampleRate = info.Length() > 2 && info[2].IsNumber() ? info[2].As<Napi::Number>().DoubleValue() : 44100;
+
+    const int recOrigin = sampleRate; // Start one second into recording
+    const int windowLength = sampleRate; // Compare one second
+    const int searchLength = 2*sampleRate; // Search the first three seconds of reference audio
+    const int referenceLength = searchLength + windowLength;
 
-    if (recordedAudio.ByteLength() < 88200*4 || referenceAudio.ByteLength() < 132300*4) {
+    if (recordedAudio.ByteLength() < (size_t)(recOrigin + windowLength)*4 || referenceAudio.ByteLength() < (size_t)referenceLength*4) {
       log(env, {"Not enough audio to align. Skipping."});
       return Napi::Number::New(env, 0);
     }
@@ -24,27 +34,27 @@ Napi::Number align(const Napi::CallbackInfo& info) {
     float* recordedData = (float*)recordedAudio.Data();
     float* referenceData = (float*)referenceAudio.Data();
 
-    const int recOrigin = 44100; // Start one second into recording
-    const int windowLength = 44100; // Compare one second
-    const int refLength = referenceAudio.ByteLength() / 4;
-
-    int recordedWindow[44100];
-    int referenceWindow[132300];
+    // Quantised to integers as before, so the FFT correlation rounds back to the exact sums
+    std::vector<double> recordedWindow(windowLength);
+    std::vector<double> referenceWindow(referenceLength);
 
-    for (auto i = 0; i < 44100; i++) {
+    for (auto i = 0; i < windowLength; i++) {
         recordedWindow[i] = (int)(recordedData[recOrigin+i] * 255);
     }
-    for (auto i = 0; i < 132300; i++) {
+    for (auto i = 0; i < referenceLength; i++) {
         referenceWindow[i] = (int)(referenceData[i] * 255);
     }
 
+    // correlation[i + windowLength - 1] is the recorded window's match against referenceWindow[i...]
+    signalsmith::Convolver<double> correlator;
+    correlator.setCorrelation(recordedWindow.data(), windowLength, windowLength);
+    std::vector<double> correlation(referenceLength);
+    correlator.process(referenceWindow.data(), correlation.data(), referenceLength);
+
     long long maxSum = 0;
     int maxSumOffset = 0;
-    for(auto i = 0; i < 88200; i++) { // Search the first three seconds of reference audio
-        long long sum = 0;
-        for(auto n = 0; n < windowLength; n++) {
-            sum += recordedWindow[n] * referenceWindow[i + n];
-        }
+    for(auto i = 0; i < searchLength; i++) {
+        long long sum = std::llround(correlation[i + windowLength - 1]);
         if (sum > maxSum) {
             maxSum = sum;
             maxSumOffset = i;
@@ -53,7 +63,7 @@ Napi::Number align(const Napi::CallbackInfo& info) {
 
     log(env, {"MaxSumOffset", std::to_string(maxSumOffset), std::to_string(maxSum)});
 
-    return Napi::Number::New(env, (maxSumOffset - recOrigin) / 44100.0); // Return the offset in seconds
+    return Napi::Number::New(env, (maxSumOffset - recOrigin) / sampleRate); // Return the offset in seconds
 }
 
 void i420overlay(const Napi::CallbackInfo& info) {
@@ -1,101 +1,460 @@
 #include <iostream>
-#include <fstream>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // M_PI isn't defined on Windows.
 #ifndef M_PI
     #define M_PI 3.14159265358979323846
 #endif
 
+// Frame sizes at 44.1/48kHz (and their halves, for RealFFT) get compile-time FFT steps
+#ifndef SIGNALSMITH_FFT_UNROLLED_SIZES
+#define SIGNALSMITH_FFT_UNROLLED_SIZES 4410, 2205, 44100, 22050, 4800, 2400, 48000, 24000
+#endif
 
 #include "lib/numeric.h"
 #include "lib/fft.h"
 #include <complex>
 
-class EchoCanceller {
-	using complex = std::complex<double>;
-	using RealArray = numeric::FreeArray<double>;
-	using ComplexArray = numeric::FreeArray<complex>;
+// Settings shared by every EchoCanceller<Sample>, so they can be chosen before the precision is
+class EchoCancellerConfig {
+public:
+	// Where linearRemoval keeps the per-frame spectra between its estimation and subtraction passes
+	enum class SpectrumCache {none, memory, file};
+	// Speed/quality trade-offs, each choosing frame lengths, overlap and precision together
+	enum class Preset {fast, balanced, best};
 
+protected:
 	double sampleRate;
-	double impulseMs = 1000;
+	double impulseMs = 1000; // also limits the detected offset to +/- half of this
 	double limitPreDelayMs = 20;
-	double subtractionMs = 100;
+	double subtractionMs = 100; // must not be longer than impulseMs
+	double suppressionStrength = 0.5; // between 0 and 1
+	size_t overlap = 4; // frames covering each sample: 2, 4 or 8, to suit getWindow()
+
+	SpectrumCache spectrumCache = SpectrumCache::none;
+	size_t threads = 1;
+	bool keepDiagnostics = false;
+	bool singlePrecision = false;
+	bool autoImpulseLength = false;
+	bool driftCompensation = false;
+	std::string speakerCacheDirectory;
 
-	RealArray getWindow(size_t chunkSamples, size_t chunkStep) {
-		RealArray window(chunkSamples);
+public:
+	EchoCancellerConfig(double sampleRate) : sampleRate(sampleRate) {}
+
+	double getSampleRate() const {
+		return sampleRate;
+	}
+
+	/* Keeping the spectra from the estimation pass saves recomputing both forward FFTs per frame in the subtraction pass.
+	That costs 2*(chunkSamples/2 + 1) complex values per frame, so long takes should use SpectrumCache::file. */
+	void setSpectrumCache(SpectrumCache mode) {
+		spectrumCache = mode;
+	}
+
+	/* fast: 50% overlap in single precision with automatic impulse length, for live preview.
+	balanced: the original settings (75% overlap, double).
+	best: a 2s impulse for long tails and wider offsets, with 87.5% overlap and drift compensation. */
+	void setPreset(Preset preset) {
+		if (preset == Preset::fast) {
+			impulseMs = 1000;
+			subtractionMs = 100;
+			overlap = 2;
+			singlePrecision = true;
+			autoImpulseLength = true;
+			driftCompensation = false;
+		} else if (preset == Preset::balanced) {
+			impulseMs = 1000;
+			subtractionMs = 100;
+			overlap = 4;
+			singlePrecision = false;
+			autoImpulseLength = false;
+			driftCompensation = false;
+		} else if (preset == Preset::best) {
+			impulseMs = 2000;
+			subtractionMs = 100;
+			overlap = 8;
+			singlePrecision = false;
+			autoImpulseLength = false;
+			driftCompensation = true;
+		}
+	}
+
+	void setSuppressionStrength(double strength) {
+		suppressionStrength = std::max(0.0, std::min(1.0, strength));
+	}
+
+	// Frames are split into contiguous ranges across this many threads (takes too short to split use fewer)
+	void setThreads(size_t threadCount) {
+		threads = std::max<size_t>(1, threadCount);
+	}
+
+	/* Probes a few full-length (impulseMs) frames first, to find the offset and how quickly the echo decays.
+	linearRemoval() then uses the shortest frames which cover the decay, with the speaker pre-shifted by that offset. */
+	void setAutoImpulseLength(bool enabled) {
+		autoImpulseLength = enabled;
+	}
+
+	/* cancel() tracks the offset across segments of the take, and if the two clocks drift apart, resamples the speaker to match the mic first.
+	The returned offset is then the one at the start of the mic recording. */
+	void setDriftCompensation(bool enabled) {
+		driftCompensation = enabled;
+	}
+
+	/* Speaker (reference) spectra from cancel() are kept in this directory, keyed by a hash of the speaker audio and the frame layout.
+	Later takes recorded against the same reference load them (memory-mapped) instead of repeating those forward FFTs.  Empty to disable. */
+	void setSpeakerCache(const std::string &directory) {
+		speakerCacheDirectory = directory;
+	}
+
+	// Keeps the estimated impulse from each cancel() call, for impulse()
+	void setDiagnostics(bool enabled) {
+		keepDiagnostics = enabled;
+	}
+
+	// Not used by EchoCanceller itself - lets callers pick EchoCanceller<float> or EchoCanceller<double> at runtime
+	void setSinglePrecision(bool enabled) {
+		singlePrecision = enabled;
+	}
+	bool isSinglePrecision() const {
+		return singlePrecision;
+	}
+};
+
+/* Spectral processing uses `Sample` (float or double), but the cross/energy statistics are always accumulated as double.
+Double is the reference mode. */
+template<typename Sample=double>
+class EchoCanceller : public EchoCancellerConfig {
+	using complex = std::complex<Sample>;
+	using RealArray = numeric::FreeArray<Sample>;
+	using ComplexArray = numeric::FreeArray<complex>;
+	using DoubleArray = numeric::FreeArray<double>;
+	using DoubleComplexArray = numeric::FreeArray<std::complex<double>>;
+
+	std::vector<float> impulseDiagnostic;
+	double driftDiagnostic = 0;
+	uint64_t speakerHash = 0; // set during cancel() when the speaker cache is in use
+
+	// Windows are immutable, so one copy per layout is shared process-wide (like FFT plans)
+	static std::shared_ptr<const RealArray> getWindow(size_t chunkSamples, size_t chunkStep) {
+		static std::mutex mutex;
+		static std::map<std::pair<size_t, size_t>, std::shared_ptr<const RealArray>> cache;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::shared_ptr<const RealArray> &cached = cache[{chunkSamples, chunkStep}];
+		if (cached) return cached;
+
+		RealArray *window = new RealArray(chunkSamples);
 		double overlapFactor = 2.0*chunkStep/chunkSamples;
 		for (size_t i = 0; i < chunkSamples; i++) {
 			double r = (i + 0.5)/chunkSamples;
-			window[i] = 0.5 - 0.5*cos(2*M_PI*r);
+			(*window)[i] = 0.5 - 0.5*cos(2*M_PI*r);
 			double s = sin(M_PI*r), c = cos(M_PI*r);
-			window[i] = s*s/sqrt(s*s*s*s + c*c*c*c);
-			window[i] *= sqrt(overlapFactor);
+			(*window)[i] = s*s/sqrt(s*s*s*s + c*c*c*c);
+			(*window)[i] *= sqrt(overlapFactor);
 		}
-		return window;
+		cached.reset(window);
+		return cached;
 	}
 
-public:
-	EchoCanceller(double sampleRate) : sampleRate(sampleRate) {}
+	// Sequential store of spectra: written in order during one pass, read back in the same order in the next
+	class FrameStore {
+		SpectrumCache mode;
+		std::vector<complex> memory;
+		size_t readIndex = 0, written = 0;
+		std::FILE *file = nullptr;
+	public:
+		FrameStore(SpectrumCache mode) {
+			reset(mode);
+		}
+		~FrameStore() {
+			if (file) std::fclose(file);
+		}
+		FrameStore(const FrameStore &other) = delete;
+		FrameStore & operator=(const FrameStore &other) = delete;
 
-	int cancel(float *speakerSamples, size_t speakerLength, float *micSamples, size_t micLength, std::string &itemId) {
-		auto speaker = numeric::wrap(speakerSamples, speakerLength);
-		auto mic = numeric::wrap(micSamples, micLength);
+		// Memory kept between passes - anything larger is freed by release()
+		static constexpr size_t maxRetainedBytes = 16*1024*1024;
 
+		// Empties the store for another cancel() - the scratch file, and memory up to maxRetainedBytes, are kept for reuse
+		void reset(SpectrumCache newMode) {
+			mode = newMode;
+			if (mode != SpectrumCache::memory) release();
+			memory.clear();
+			readIndex = written = 0;
+			if (mode == SpectrumCache::file && !file) {
+				file = std::tmpfile();
+				// No scratch file available - fall back to recomputing
+				if (!file) mode = SpectrumCache::none;
+			}
+			if (file) std::rewind(file);
+		}
 
-		int offsetSamples = linearRemoval(speaker, mic, itemId);
+		void write(const complex *data, size_t size) {
+			if (mode == SpectrumCache::memory) {
+				memory.insert(memory.end(), data, data + size);
+			} else if (mode == SpectrumCache::file) {
+				// Out of scratch space - give up on the cache entirely
+				if (std::fwrite(data, sizeof(complex), size, file) != size) mode = SpectrumCache::none;
+			}
+			written += size;
+		}
+		void rewind() {
+			readIndex = 0;
+			if (file) std::rewind(file);
+		}
+		// Called once a pass has read everything back, so one long take doesn't pin its spectra until the next cancel()
+		void release() {
+			if (memory.capacity()*sizeof(complex) > maxRetainedBytes) {
+				std::vector<complex>().swap(memory);
+			}
+			memory.clear();
+			readIndex = written = 0;
+		}
+		// Returns false if the caller needs to recompute this (and every later) frame
+		bool read(complex *data, size_t size) {
+			// A reused scratch file can hold stale frames beyond this pass
+			if (readIndex + size > written) mode = SpectrumCache::none;
+			if (mode == SpectrumCache::memory) {
+				std::copy(memory.begin() + readIndex, memory.begin() + readIndex + size, data);
+				readIndex += size;
+				return true;
+			} else if (mode == SpectrumCache::file) {
+				if (std::fread(data, sizeof(complex), size, file) == size) {
+					readIndex += size;
+					return true;
+				}
+				mode = SpectrumCache::none;
+			}
+			return false;
+		}
+	};
 
-		// Strength: between 0 and 1
-		energySuppression(speaker, mic, 0.5);
+	// FNV-1a over the raw samples - identifies a speaker signal for SpeakerSpectra
+	static uint64_t hashSamples(const float *samples, size_t length) {
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < length; ++i) {
+			uint32_t bits;
+			std::memcpy(&bits, &samples[i], sizeof(bits));
+			hash = (hash ^ bits)*1099511628211ull;
+		}
+		return hash;
+	}
 
-		normalise(mic);
+	/* Windowed speaker spectra for every frame of one layout (chunkSamples, chunkStep), stored in speakerCacheDirectory.
+	An existing file is memory-mapped.  Otherwise frames go straight to a partial file as they're computed, and save() fills in the rest and renames it into place. */
+	class SpeakerSpectra {
+		struct Header {
+			char magic[8];
+			uint64_t hash, length, chunkSamples, chunkStep, sampleBytes, frames;
+		};
+		std::string path, partial;
+		Header header;
+		size_t bins;
+		const complex *mapped = nullptr;
+		void *mapping = nullptr;
+		size_t mappingBytes = 0;
+		// The complete file (if it couldn't be mapped), or the partial one being written
+		std::FILE *file = nullptr;
+		std::mutex fileMutex;
+		std::vector<char> filled;
+		bool loaded = false;
 
-		return offsetSamples;
-	}
+		bool matches(const Header &other) const {
+			return std::memcmp(&other, &header, sizeof(Header)) == 0;
+		}
 
-	template <typename Array1, typename Array2>
-	int linearRemoval(Array1 &speaker, Array2 &mic, std::string &itemId) {
-		size_t chunkSamples = (int)(sampleRate*impulseMs*0.001);
-		size_t chunkStep = chunkSamples/4;
+		void load() {
+			size_t dataBytes = header.frames*bins*sizeof(complex);
+#ifndef _WIN32
+			int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0) return;
+			struct stat info;
+			if (fstat(fd, &info) == 0 && (size_t)info.st_size == sizeof(Header) + dataBytes) {
+				void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+				if (memory != MAP_FAILED) {
+					if (matches(*(const Header *)memory)) {
+						mapping = memory;
+						mappingBytes = info.st_size;
+						mapped = (const complex *)((const char *)memory + sizeof(Header));
+						loaded = true;
+						futimens(fd, nullptr); // marks it as recently used, for eviction
+					} else {
+						munmap(memory, info.st_size);
+					}
+				}
+			}
+			close(fd);
+#else
+			file = std::fopen(path.c_str(), "rb");
+			if (!file) return;
+			Header fileHeader;
+			if (std::fread(&fileHeader, sizeof(Header), 1, file) == 1 && matches(fileHeader)
+					&& std::fseek(file, 0, SEEK_END) == 0 && (size_t)std::ftell(file) == sizeof(Header) + dataBytes) {
+				loaded = true;
+			} else {
+				std::fclose(file);
+				file = nullptr;
+			}
+#endif
+		}
 
-		ComplexArray extract(chunkSamples);
-		ComplexArray speakerSpectrum(chunkSamples), micSpectrum(chunkSamples);
+		bool seek(size_t frame) {
+			return std::fseek(file, (long)(sizeof(Header) + frame*bins*sizeof(complex)), SEEK_SET) == 0;
+		}
+		// Any failure drops the partial file, and later frames are just computed
+		void abandon() {
+			if (!file || loaded) return;
+			std::fclose(file);
+			file = nullptr;
+			std::remove(partial.c_str());
+		}
 
-		ComplexArray crossSum(chunkSamples);
-		RealArray speakerEnergy(chunkSamples);
-		crossSum.fill(0);
-		speakerEnergy.fill(0);
+	public:
+		SpeakerSpectra(const std::string &directory, uint64_t hash, size_t length, size_t chunkSamples, size_t chunkStep, size_t bins) : bins(bins) {
+			std::memset(&header, 0, sizeof(Header));
+			std::memcpy(header.magic, "VCSPECT1", 8);
+			header.hash = hash;
+			header.length = length;
+			header.chunkSamples = chunkSamples;
+			header.chunkStep = chunkStep;
+			header.sampleBytes = sizeof(Sample);
+			header.frames = (length > chunkSamples) ? (length - chunkSamples - 1)/chunkStep + 1 : 0;
+			char name[96];
+			std::snprintf(name, sizeof(name), "/%016llx-%llu-%llu-%llu.spectra", (unsigned long long)hash, (unsigned long long)chunkSamples, (unsigned long long)chunkStep, (unsigned long long)sizeof(Sample));
+			path = directory + name;
+			load();
+			if (!loaded) {
+				filled.resize(header.frames, 0);
+				// Unique per object, since other takes may be writing the same file
+				partial = path + ".partial" + std::to_string((uintptr_t)this);
+				file = std::fopen(partial.c_str(), "w+b");
+				// The header goes in last, so a half-written file never matches
+				Header blank;
+				std::memset(&blank, 0, sizeof(Header));
+				if (file && std::fwrite(&blank, sizeof(Header), 1, file) != 1) abandon();
+			}
+		}
+		~SpeakerSpectra() {
+#ifndef _WIN32
+			if (mapping) munmap(mapping, mappingBytes);
+#endif
+			if (loaded) {
+				if (file) std::fclose(file);
+			} else {
+				abandon();
+			}
+		}
+		SpeakerSpectra(const SpeakerSpectra &other) = delete;
+		SpeakerSpectra & operator=(const SpeakerSpectra &other) = delete;
 
-		size_t sharedLength = std::min(speaker.size(), mic.size());
-		RealArray window = getWindow(chunkSamples, chunkStep);
-		signalsmith::FFT<double> fft(chunkSamples);
-		ComplexArray output(sharedLength);
+		// Copies a frame into `spectrum`, or returns false if it hasn't been computed
+		bool read(size_t frame, complex *spectrum) {
+			if (frame >= header.frames) return false;
+			if (mapped) {
+				const complex *data = mapped + frame*bins;
+				std::copy(data, data + bins, spectrum);
+				return true;
+			}
+			if (!loaded && !filled[frame]) return false;
+			std::lock_guard<std::mutex> lock(fileMutex);
+			if (file && seek(frame) && std::fread(spectrum, sizeof(complex), bins, file) == bins) return true;
+			abandon();
+			return false;
+		}
+		// Different threads may store different frames at the same time
+		void store(size_t frame, const complex *spectrum) {
+			if (loaded || frame >= header.frames) return;
+			std::lock_guard<std::mutex> lock(fileMutex);
+			if (!file) return;
+			if (seek(frame) && std::fwrite(spectrum, sizeof(complex), bins, file) == bins) {
+				filled[frame] = 1;
+			} else {
+				abandon();
+			}
+		}
 
-		// Estimate impulse on a per-frequency basis
-		for (size_t position = 0; position + chunkSamples < sharedLength; position += chunkStep) {
-			extract = speaker.slice(position, chunkSamples, 1)*window;
-			fft.fft(&extract[0], &speakerSpectrum[0]);
-			
-			extract = mic.slice(position, chunkSamples, 1)*window;
-			fft.fft(&extract[0], &micSpectrum[0]);
+		// Computes any frames the take didn't reach, and renames the file into place
+		template<typename Array>
+		void save(Array &speaker, const RealArray &window, signalsmith::RealFFT<Sample> &fft, RealArray &extract, ComplexArray &spectrum) {
+			if (loaded) return;
+			for (size_t frame = 0; frame < header.frames && file; ++frame) {
+				if (filled[frame]) continue;
+				windowInput(speaker, frame*header.chunkStep, window, extract);
+				fft.fft(&extract[0], &spectrum[0]);
+				store(frame, &spectrum[0]);
+			}
+			if (!file) return;
+			std::rewind(file);
+			bool written = std::fwrite(&header, sizeof(Header), 1, file) == 1;
+			written = (std::fclose(file) == 0) && written;
+			file = nullptr;
+			if (!written || std::rename(partial.c_str(), path.c_str()) != 0) {
+				std::remove(partial.c_str());
+			}
+		}
+	};
 
-			for (size_t i = 0; i < chunkSamples; ++i) {
-				crossSum[i] += micSpectrum[i]*conj(speakerSpectrum[i]);
-				speakerEnergy[i] += norm(speakerSpectrum[i]);
+	// Cached speaker spectra for this layout, or null if the speaker cache isn't in use for this cancel()
+	std::unique_ptr<SpeakerSpectra> openSpeakerSpectra(size_t speakerLength, size_t chunkSamples, size_t chunkStep, size_t bins) {
+		if (speakerCacheDirectory.empty() || !speakerHash) return nullptr;
+		return std::unique_ptr<SpeakerSpectra>(new SpeakerSpectra(speakerCacheDirectory, speakerHash, speakerLength, chunkSamples, chunkStep, bins));
+	}
+
+	// Overlap-add accumulator which only keeps the most recent `size` samples, so memory doesn't grow with the take length
+	class OverlapAdd {
+		std::vector<Sample> ring;
+		size_t start; // nothing is ever added before this index
+		size_t frontier; // everything at or after this index is still zero
+	public:
+		OverlapAdd(size_t size, size_t start=0) : ring(size, 0), start(start), frontier(start) {}
+
+		void add(size_t position, const RealArray &frame) {
+			size_t end = position + frame.size();
+			assert(frame.size() <= ring.size());
+			for (; frontier < end; ++frontier) {
+				ring[frontier%ring.size()] = 0;
+			}
+			for (size_t i = 0; i < frame.size(); ++i) {
+				ring[(position + i)%ring.size()] += frame[i];
 			}
 		}
 
-		// Limit pre-delay by fading before peak
-		ComplexArray impulseSpectrum(chunkSamples);
-		ComplexArray impulse(chunkSamples);
-		for (size_t i = 0; i < chunkSamples; ++i) {
-			impulseSpectrum[i] = crossSum[i]/speakerEnergy[i];
+		Sample operator[](size_t index) const {
+			if (index < start || index >= frontier) return 0;
+			assert(index + ring.size() >= frontier);
+			return ring[index%ring.size()];
+		}
+	};
+
+	// Impulse from the accumulated cross-spectrum, with pre-delay limited by fading before the peak.  Returns the peak position.
+	int estimateImpulse(signalsmith::RealFFT<Sample> &fft, const DoubleComplexArray &crossSum, const DoubleArray &speakerEnergy, ComplexArray &impulseSpectrum, RealArray &impulse) {
+		size_t chunkSamples = impulse.size();
+		for (size_t i = 0; i < impulseSpectrum.size(); ++i) {
+			impulseSpectrum[i] = complex((speakerEnergy[i] > 0) ? crossSum[i]/speakerEnergy[i] : 0);
 		}
 		fft.ifft(&impulseSpectrum[0], &impulse[0]);
-		impulse /= impulse.size();
+		impulse /= (Sample)impulse.size();
 		int peakIndex = 0;
 		double peakAbs = 0;
 		for (size_t i = 0; i < chunkSamples; i++) {
-			double a = abs(impulse[i]);
+			double a = std::abs(impulse[i]);
 			if (a > peakAbs) {
 				peakAbs = a;
 				peakIndex = i;
@@ -114,42 +473,540 @@ public:
 			}
 		}
 		fft.fft(&impulse[0], &impulseSpectrum[0]);
+		return peakIndex;
+	}
 
-		int shiftSamples = peakIndex;
-
-		// Apply estimated impulse and subtract
-		output.fill(0);
-		for (size_t position = 0; position + chunkSamples < sharedLength; position += chunkStep) {
-			extract = speaker.slice(position, chunkSamples, 1)*window;
-			fft.fft(&extract[0], &speakerSpectrum[0]);
+	// Scales the mic spectrum down by the energy predicted from the speaker, updating the running statistics
+	void suppressFrame(const ComplexArray &speakerSpectrum, ComplexArray &micSpectrum, DoubleArray &subtractionCross, DoubleArray &subtractionEnergy, double strength, size_t chunkSamples) {
+		// Real input, so the mirrored bin (chunkSamples - i) has the same energy
+		for (size_t i = 1; i < chunkSamples/2; ++i) {
+			double refEnergy = 2*norm(speakerSpectrum[i]);
 			
-			extract = mic.slice(position, chunkSamples, 1)*window;
-			fft.fft(&extract[0], &micSpectrum[0]);
+			double micEnergy = 2*norm(micSpectrum[i]);
+			subtractionCross[i] += micEnergy*refEnergy;
+			subtractionEnergy[i] += refEnergy*refEnergy;
+
+			double energyFactor = subtractionCross[i]/(subtractionEnergy[i]+1e-6);
+			double subtractedEnergy = micEnergy - strength*energyFactor*refEnergy;
+			double ampFactor = sqrt(std::max(0.0, subtractedEnergy)/(micEnergy+1e-6));
+			micSpectrum[i] *= (Sample)ampFactor;
+		}
+	}
+
+	// FFT and scratch space for one thread's share of the frames
+	struct FrameWorker {
+		signalsmith::RealFFT<Sample> fft;
+		RealArray extract, pairExtract;
+		ComplexArray speakerSpectrum, micSpectrum;
+		// Per-thread statistics: linearRemoval uses crossSum/energy, energySuppression uses subtractionCross/subtractionEnergy
+		DoubleComplexArray crossSum;
+		DoubleArray energy, subtractionCross, subtractionEnergy;
+		FrameStore frameStore;
+
+		FrameWorker(size_t chunkSamples, SpectrumCache cache) : fft(chunkSamples), extract(chunkSamples), pairExtract(chunkSamples),
+				speakerSpectrum(fft.bins()), micSpectrum(fft.bins()), crossSum(fft.bins()),
+				energy(fft.bins()), subtractionCross(fft.bins()), subtractionEnergy(fft.bins()), frameStore(cache) {}
+	};
+
+	// Window, impulse buffers and per-thread FFTs/scratch for one frame layout, kept between cancel() calls
+	struct Workspace {
+		size_t chunkSamples, chunkStep;
+		std::shared_ptr<const RealArray> window;
+		RealArray impulse;
+		ComplexArray impulseSpectrum;
+		std::vector<std::unique_ptr<FrameWorker>> workers;
+
+		Workspace(size_t chunkSamples, size_t chunkStep, std::shared_ptr<const RealArray> window) : chunkSamples(chunkSamples), chunkStep(chunkStep),
+				window(window), impulse(chunkSamples), impulseSpectrum(chunkSamples/2 + 1) {}
+
+		std::vector<FrameWorker *> workersFor(size_t threadCount) {
+			std::vector<FrameWorker *> result;
+			for (size_t t = 0; t < threadCount; ++t) result.push_back(workers[t].get());
+			return result;
+		}
+	};
+	std::vector<std::unique_ptr<Workspace>> workspaces; // most recently used first
+	size_t maxWorkspaces = 4;
+
+	// Workspace for this layout with at least `threadCount` workers, whose FrameStores are emptied and set to `cache`
+	Workspace & useWorkspace(size_t chunkSamples, size_t chunkStep, size_t threadCount, SpectrumCache cache) {
+		auto found = std::find_if(workspaces.begin(), workspaces.end(), [&](const std::unique_ptr<Workspace> &w) {
+			return w->chunkSamples == chunkSamples && w->chunkStep == chunkStep;
+		});
+		std::unique_ptr<Workspace> chosen;
+		if (found != workspaces.end()) {
+			chosen = std::move(*found);
+			workspaces.erase(found);
+		} else {
+			chosen.reset(new Workspace(chunkSamples, chunkStep, getWindow(chunkSamples, chunkStep)));
+		}
+		workspaces.insert(workspaces.begin(), std::move(chosen));
+		if (workspaces.size() > maxWorkspaces) workspaces.pop_back();
+
+		Workspace &workspace = *workspaces[0];
+		while (workspace.workers.size() < threadCount) {
+			workspace.workers.emplace_back(new FrameWorker(chunkSamples, SpectrumCache::none));
+		}
+		for (auto &worker : workspace.workers) worker->frameStore.reset(cache);
+		return workspace;
+	}
+
+	// Windowed frame of `input` from `position`, where anything outside the input is silence
+	template<typename Array>
+	static void windowInput(Array &input, long position, const RealArray &window, RealArray &extract) {
+		long start = std::max<long>(0, std::min<long>(window.size(), -position));
+		long end = std::max<long>(start, std::min<long>(window.size(), (long)input.size() - position));
+		for (long i = 0; i < start; ++i) extract[i] = 0;
+		for (long i = start; i < end; ++i) extract[i] = input[position + i]*window[i];
+		for (long i = end; i < (long)window.size(); ++i) extract[i] = 0;
+	}
+
+	// Speaker spectrum for one frame into worker.speakerSpectrum, taken from (or added to) the cached spectra if there are any
+	template<typename Array>
+	void speakerFrame(Array &speaker, long position, size_t frame, const RealArray &window, FrameWorker &worker, SpeakerSpectra *cache) {
+		if (cache && cache->read(frame, &worker.speakerSpectrum[0])) return;
+		windowInput(speaker, position, window, worker.extract);
+		worker.fft.fft(&worker.extract[0], &worker.speakerSpectrum[0]);
+		if (cache) cache->store(frame, &worker.speakerSpectrum[0]);
+	}
+
+	/* Unscaled, uncropped impulse (left in worker.extract, with the cross-spectrum in worker.crossSum) from at most `maxFrames` non-overlapping frames spread across [start, end).
+	Returns false if there isn't a complete frame, and otherwise sets the mean centre of the frames used. */
+	template <typename Array1, typename Array2>
+	bool probeImpulse(Array1 &speaker, Array2 &mic, size_t start, size_t end, size_t maxFrames, FrameWorker &worker, const RealArray &window, double &centre) {
+		size_t chunkSamples = window.size();
+		size_t frames = (end > start + chunkSamples) ? (end - start - chunkSamples - 1)/chunkSamples + 1 : 0;
+		if (frames == 0) return false;
+
+		size_t bins = worker.fft.bins();
+		worker.crossSum.fill(0);
+		worker.energy.fill(0);
+		size_t used = std::min(frames, maxFrames);
+		centre = 0;
+		for (size_t p = 0; p < used; ++p) {
+			size_t position = start + (p*frames/used)*chunkSamples;
+			centre += (position + 0.5*chunkSamples)/used;
+			windowInput(speaker, position, window, worker.extract);
+			windowInput(mic, position, window, worker.pairExtract);
+			worker.fft.fftPair(&worker.extract[0], &worker.pairExtract[0], &worker.speakerSpectrum[0], &worker.micSpectrum[0]);
+			for (size_t i = 0; i < bins; ++i) {
+				worker.crossSum[i] += worker.micSpectrum[i]*conj(worker.speakerSpectrum[i]);
+				worker.energy[i] += norm(worker.speakerSpectrum[i]);
+			}
+		}
+		for (size_t i = 0; i < bins; ++i) {
+			worker.micSpectrum[i] = complex((worker.energy[i] > 0) ? worker.crossSum[i]/worker.energy[i] : 0);
+		}
+		worker.fft.ifft(&worker.micSpectrum[0], &worker.extract[0]);
+		return true;
+	}
+
+	/* Cheap first pass for autoImpulseLength: a full-length impulse from a few frames spread across the take.
+	Sets the peak position, and returns how long after it the echo stays above the estimation noise (0 if the take is too short to probe). */
+	template <typename Array1, typename Array2>
+	size_t probeDecay(Array1 &speaker, Array2 &mic, size_t sharedLength, size_t chunkSamples, int &peakIndex) {
+		Workspace &workspace = useWorkspace(chunkSamples, chunkSamples/2, 1, SpectrumCache::none);
+		FrameWorker &worker = *workspace.workers[0];
+		const RealArray &window = *workspace.window;
+		double centre;
+		if (!probeImpulse(speaker, mic, 0, sharedLength, 32, worker, window, centre)) return 0;
+		RealArray &impulse = worker.extract;
 
+		size_t peak = 0;
+		for (size_t i = 0; i < chunkSamples; ++i) {
+			if (std::abs(impulse[i]) > std::abs(impulse[peak])) peak = i;
+		}
+		peakIndex = (peak > chunkSamples/2) ? (int)peak - (int)chunkSamples : (int)peak;
+		auto energyAt = [&](long offset) -> double {
+			double sample = impulse[((long)peak + offset + (long)chunkSamples)%chunkSamples];
+			return sample*sample;
+		};
+
+		// Nothing can legitimately arrive before the pre-delay limit, so the half-length before that is estimation noise
+		long half = chunkSamples/2;
+		long preDelay = limitPreDelayMs*0.001*sampleRate;
+		double noise = 0;
+		for (long i = -half + 1; i < -preDelay; ++i) noise += energyAt(i);
+		noise /= std::max<long>(1, half - 1 - preDelay);
+		double threshold = std::max(10*noise, 1e-6*energyAt(0));
+
+		// Last 5ms block after the peak whose mean energy is above the threshold
+		long block = std::max<long>(1, 0.005*sampleRate);
+		size_t decay = block;
+		for (long start = 0; start + block <= half; start += block) {
+			double sum = 0;
+			for (long i = start; i < start + block; ++i) sum += energyAt(i);
+			if (sum > threshold*block) decay = start + block;
+		}
+		return decay;
+	}
+
+	/* Least-squares fit of the offset across segments of the take.
+	Each segment's offset relative to the first is the integer peak difference, refined by the phase slope between their cross-spectra (which cancels the echo path itself).
+	Returns the drift in samples per sample, or 0 if the take is too short or the fit isn't plausible.  Sets the fitted offset at the start of the mic. */
+	template <typename Array1, typename Array2>
+	double estimateDrift(Array1 &speaker, Array2 &mic, double &startOffset) {
+		size_t sharedLength = std::min(speaker.size(), mic.size());
+		size_t chunkSamples = (int)(sampleRate*impulseMs*0.001);
+		size_t segments = std::min<size_t>(16, sharedLength/(4*chunkSamples));
+		startOffset = 0;
+		if (segments < 4) return 0;
+
+		Workspace &workspace = useWorkspace(chunkSamples, chunkSamples/2, 1, SpectrumCache::none);
+		FrameWorker &worker = *workspace.workers[0];
+		const RealArray &window = *workspace.window;
+		size_t bins = worker.fft.bins();
+		DoubleComplexArray firstCross(bins);
+		long firstPeak = 0;
+		std::vector<double> times, offsets;
+		for (size_t segment = 0; segment < segments; ++segment) {
+			size_t start = segment*sharedLength/segments, end = (segment + 1)*sharedLength/segments;
+			double centre;
+			if (!probeImpulse(speaker, mic, start, end, 4, worker, window, centre)) continue;
+			RealArray &impulse = worker.extract;
+			size_t peak = 0;
 			for (size_t i = 0; i < chunkSamples; ++i) {
-				micSpectrum[i] -= impulseSpectrum[i]*speakerSpectrum[i];
+				if (std::abs(impulse[i]) > std::abs(impulse[peak])) peak = i;
+			}
+			long offset = (peak > chunkSamples/2) ? (long)peak - (long)chunkSamples : (long)peak;
+			if (times.empty()) {
+				firstCross = worker.crossSum;
+				firstPeak = offset;
 			}
 
-			fft.ifft(&micSpectrum[0], &extract[0]);
-			extract /= (double)chunkSamples;
+			/* The peaks can be a few samples out, so refine coarse-to-fine: the phase left after removing the current estimate
+			doesn't wrap below a frequency which doubles each step */
+			double delay = offset - firstPeak;
+			for (double maxOmega = M_PI/16; maxOmega <= M_PI/2; maxOmega *= 2) {
+				double sumWeighted = 0, sumSquares = 0;
+				for (size_t i = 1; i < bins && 2*M_PI*i/chunkSamples < maxOmega; ++i) {
+					double omega = 2*M_PI*i/chunkSamples;
+					std::complex<double> relative = worker.crossSum[i]*conj(firstCross[i])*std::polar(1.0, omega*delay);
+					double weight = std::abs(relative);
+					sumWeighted += weight*omega*std::arg(relative);
+					sumSquares += weight*omega*omega;
+				}
+				if (sumSquares > 0) delay -= sumWeighted/sumSquares;
+			}
+			times.push_back(centre);
+			offsets.push_back(firstPeak + delay);
+		}
 
-			output.slice(position, chunkSamples, 1) += extract*window;
+		// Fit, then refit without segments more than 1ms off the line (e.g. silence, or a wrong peak)
+		double drift = 0;
+		for (int pass = 0; pass < 2; ++pass) {
+			double n = 0, sumT = 0, sumO = 0, sumTT = 0, sumTO = 0;
+			for (size_t i = 0; i < times.size(); ++i) {
+				if (pass > 0 && std::abs(offsets[i] - startOffset - drift*times[i]) > 0.001*sampleRate) continue;
+				n += 1;
+				sumT += times[i];
+				sumO += offsets[i];
+				sumTT += times[i]*times[i];
+				sumTO += times[i]*offsets[i];
+			}
+			double denominator = n*sumTT - sumT*sumT;
+			if (n < 4 || denominator <= 0) return 0;
+			drift = (n*sumTO - sumT*sumO)/denominator;
+			startOffset = (sumO - drift*sumT)/n;
 		}
-		for (size_t i = 0; i < mic.size(); ++i) {
-			int i2 = i + shiftSamples;
-			if (i2 >= 0 && i2 < (int)output.size()) {
-				mic[i] = output[i2].real();
-			} else {
-				mic[i] = 0;
+		// Below 1ppm isn't worth resampling for, and above 1000ppm isn't clock drift
+		if (std::abs(drift) < 1e-6 || std::abs(drift) > 1e-3) return 0;
+		return drift;
+	}
+
+	// Windowed-sinc interpolation at fractional positions, from a table of kernel phases
+	class SincInterpolator {
+		static const int radius = 16, phases = 256;
+		std::vector<float> table; // (phases + 1) rows of 2*radius taps
+	public:
+		SincInterpolator() : table((phases + 1)*2*radius) {
+			const double cutoff = 0.95; // of Nyquist
+			for (int p = 0; p <= phases; ++p) {
+				double fraction = (double)p/phases;
+				for (int i = 0; i < 2*radius; ++i) {
+					double x = i - radius + 1 - fraction;
+					double sinc = (x == 0) ? 1 : sin(M_PI*cutoff*x)/(M_PI*cutoff*x);
+					double window = 0.5 + 0.5*cos(M_PI*x/radius);
+					table[p*2*radius + i] = cutoff*sinc*window;
+				}
+			}
+		}
+
+		// Anything outside the input is silence
+		double operator()(const float *input, size_t length, double position) const {
+			double floorPosition = std::floor(position);
+			double phase = (position - floorPosition)*phases;
+			int p = std::min<int>(phase, phases - 1);
+			double blend = phase - p;
+			const float *row0 = &table[p*2*radius], *row1 = row0 + 2*radius;
+			long first = (long)floorPosition - radius + 1;
+			double sum = 0;
+			for (int i = 0; i < 2*radius; ++i) {
+				long index = first + i;
+				if (index < 0 || index >= (long)length) continue;
+				sum += input[index]*(row0[i] + blend*(row1[i] - row0[i]));
+			}
+			return sum;
+		}
+	};
+
+	struct FrameRange {
+		size_t start, end;
+	};
+	// Splits the frames into one contiguous range per thread.  Each range needs enough frames that seams don't interact.
+	std::vector<FrameRange> frameRanges(size_t sharedLength, size_t chunkSamples, size_t chunkStep) {
+		size_t frames = (sharedLength > chunkSamples) ? (sharedLength - chunkSamples - 1)/chunkStep + 1 : 0;
+		size_t minFramesPerThread = 4*chunkSamples/chunkStep;
+		size_t threadCount = std::max<size_t>(1, std::min(threads, frames/minFramesPerThread));
+		std::vector<FrameRange> ranges;
+		for (size_t t = 0; t < threadCount; ++t) {
+			ranges.push_back({frames*t/threadCount, frames*(t + 1)/threadCount});
+		}
+		return ranges;
+	}
+
+	// Runs fn(0) ... fn(threadCount - 1), all but the first on new threads
+	template<class Fn>
+	static void runThreads(size_t threadCount, Fn &&fn) {
+		std::vector<std::thread> workers;
+		for (size_t t = 1; t < threadCount; ++t) {
+			workers.emplace_back(fn, t);
+		}
+		fn(0);
+		for (auto &worker : workers) worker.join();
+	}
+
+	/* Overlap-adds frames (from processFrame(thread, position)) and writes the result into `mic`, shifted by `shiftSamples`.
+
+	Each thread writes finished samples straight back into `mic`, but only where both the sample and its (shifted) source are away from the seams with its neighbours.  The output around each seam is kept separately by both threads, and those samples are filled in afterwards.  This keeps each thread from overwriting another's input. */
+	template<class MicArray, class ProcessFrame>
+	void overlapAddInPlace(MicArray &mic, size_t outputLength, size_t sharedLength, size_t chunkSamples, size_t chunkStep, int shiftSamples, const std::vector<FrameRange> &ranges, ProcessFrame &&processFrame) {
+		size_t threadCount = ranges.size();
+		long margin = std::max<long>(chunkSamples/2, std::abs(shiftSamples)) + 1; // more than the shift
+		// Seam t is where threads t-1 and t both add output
+		std::vector<long> seamStart(threadCount + 1), seamEnd(threadCount + 1);
+		for (size_t t = 1; t < threadCount; ++t) {
+			seamStart[t] = ranges[t].start*chunkStep;
+			seamEnd[t] = seamStart[t] + chunkSamples - chunkStep;
+		}
+		// Output from each thread near its seams (before/after)
+		std::vector<std::vector<double>> seamBefore(threadCount), seamAfter(threadCount);
+		auto seamWindowStart = [&](size_t seam) {
+			return seamStart[seam] - 2*margin;
+		};
+		size_t seamWindowLength = chunkSamples - chunkStep + 4*margin;
+
+		runThreads(threadCount, [&](size_t thread) {
+			long zoneStart = (thread > 0) ? seamEnd[thread] : LONG_MIN;
+			long zoneEnd = (thread + 1 < threadCount) ? seamStart[thread + 1] : LONG_MAX;
+			size_t firstPosition = ranges[thread].start*chunkStep;
+
+			// Output is shifted when written back, so keep two frames of history plus the shift
+			OverlapAdd output(2*chunkSamples + std::abs(shiftSamples), firstPosition);
+			size_t written = (thread > 0) ? zoneStart : 0;
+			long copied = firstPosition;
+			// Only output up to the end of this thread's last frame is needed for the seams
+			long copyEnd = (threadCount > 1) ? (ranges[thread].end - 1)*chunkStep + chunkSamples : copied;
+			if (thread > 0) seamBefore[thread].resize(seamWindowLength, 0);
+			if (thread + 1 < threadCount) seamAfter[thread].resize(seamWindowLength, 0);
+
+			// Output before `finished` is complete, and `mic` is still needed as input from `readFrom` onwards
+			auto writeBack = [&](size_t finished, size_t readFrom) {
+				for (; copied < std::min<long>(finished, copyEnd); ++copied) {
+					long offset = copied - (thread > 0 ? seamWindowStart(thread) : 0);
+					if (thread > 0 && offset >= 0 && offset < (long)seamWindowLength) {
+						seamBefore[thread][offset] = output[copied];
+					}
+					offset = copied - (thread + 1 < threadCount ? seamWindowStart(thread + 1) : 0);
+					if (thread + 1 < threadCount && offset >= 0 && offset < (long)seamWindowLength) {
+						seamAfter[thread][offset] = output[copied];
+					}
+				}
+				for (; written < readFrom && written < outputLength && (long)written < zoneEnd; ++written) {
+					long i2 = (long)written + shiftSamples;
+					if (i2 < zoneStart || i2 >= zoneEnd) continue; // near a seam, filled in later
+					if (i2 >= 0 && i2 < (long)sharedLength) {
+						if (i2 >= (long)finished) break;
+						mic[written] = output[i2];
+					} else {
+						mic[written] = 0;
+					}
+				}
+			};
+
+			for (size_t frame = ranges[thread].start; frame < ranges[thread].end; ++frame) {
+				size_t position = frame*chunkStep;
+				writeBack(position, position);
+				output.add(position, processFrame(thread, position));
+			}
+			writeBack(sharedLength, outputLength);
+		});
+
+		// Fill in the samples near each seam from both threads' output
+		for (size_t seam = 1; seam < threadCount; ++seam) {
+			long windowStart = seamWindowStart(seam);
+			long start = std::max<long>(0, seamStart[seam] - margin);
+			long end = std::min<long>(outputLength, seamEnd[seam] + margin);
+			for (long i = start; i < end; ++i) {
+				long i2 = i + shiftSamples;
+				bool writtenBefore = i < seamStart[seam] && i2 < seamStart[seam];
+				bool writtenAfter = i >= seamEnd[seam] && i2 >= seamEnd[seam];
+				if (writtenBefore || writtenAfter) continue;
+				if (i2 >= 0 && i2 < (long)sharedLength) {
+					mic[i] = seamAfter[seam - 1][i2 - windowStart] + seamBefore[seam][i2 - windowStart];
+				} else {
+					mic[i] = 0;
+				}
+			}
+		}
+	}
+
+public:
+	EchoCanceller(double sampleRate) : EchoCancellerConfig(sampleRate) {}
+	EchoCanceller(const EchoCancellerConfig &config) : EchoCancellerConfig(config) {}
+
+	// Time-domain impulse (speaker to mic) from the last linearRemoval(), with the peak at offset cancel() returned (mod its length)
+	const std::vector<float> & impulse() const {
+		return impulseDiagnostic;
+	}
+
+	// Estimated clock drift (parts per million, positive if the mic clock runs fast) from the last cancel() with drift compensation
+	double drift() const {
+		return driftDiagnostic*1e6;
+	}
+
+	int cancel(float *speakerSamples, size_t speakerLength, float *micSamples, size_t micLength) {
+		std::vector<float> resampled;
+		driftDiagnostic = 0;
+		if (driftCompensation) {
+			auto speaker = numeric::wrap(speakerSamples, speakerLength);
+			auto mic = numeric::wrap(micSamples, micLength);
+			double startOffset;
+			driftDiagnostic = estimateDrift(speaker, mic, startOffset);
+			if (driftDiagnostic != 0) {
+				// mic[t] lines up with speaker[t - startOffset - drift*t], so resample the speaker to remove the drift term
+				SincInterpolator interpolator;
+				resampled.resize(speakerLength);
+				for (size_t i = 0; i < speakerLength; ++i) {
+					resampled[i] = interpolator(speakerSamples, speakerLength, i - driftDiagnostic*(i + startOffset));
+				}
+				speakerSamples = resampled.data();
+			}
+		}
+		// A resampled speaker is particular to this take, so isn't worth caching
+		speakerHash = (!speakerCacheDirectory.empty() && resampled.empty()) ? hashSamples(speakerSamples, speakerLength) : 0;
+		auto speaker = numeric::wrap(speakerSamples, speakerLength);
+		auto mic = numeric::wrap(micSamples, micLength);
+
+		int offsetSamples = linearRemoval(speaker, mic);
+
+		energySuppression(speaker, mic, suppressionStrength);
+		speakerHash = 0;
+
+		normalise(mic);
+
+		return offsetSamples;
+	}
+
+	template <typename Array1, typename Array2>
+	int linearRemoval(Array1 &speaker, Array2 &mic) {
+		size_t chunkSamples = (int)(sampleRate*impulseMs*0.001);
+		size_t sharedLength = std::min(speaker.size(), mic.size());
+
+		// Speaker frames are read this much earlier, so the impulse only has to cover the echo decay
+		int leadSamples = 0;
+		if (autoImpulseLength) {
+			int probePeak = 0;
+			size_t decay = probeDecay(speaker, mic, sharedLength, chunkSamples, probePeak);
+			size_t preDelay = limitPreDelayMs*0.001*sampleRate;
+			// Frames a few times the impulse length, so circular wrap-around stays small (and a multiple of 8 for any overlap)
+			size_t shortChunk = signalsmith::FFT<Sample>::fastSizeAbove((4*(preDelay + decay) + 7)/8)*8;
+			if (decay > 0 && shortChunk < chunkSamples) {
+				chunkSamples = shortChunk;
+				leadSamples = probePeak;
 			}
 		}
+		size_t chunkStep = chunkSamples/overlap;
+
+		auto ranges = frameRanges(sharedLength, chunkSamples, chunkStep);
+		Workspace &workspace = useWorkspace(chunkSamples, chunkStep, ranges.size(), spectrumCache);
+		const RealArray &window = *workspace.window;
+		std::vector<FrameWorker *> workers = workspace.workersFor(ranges.size());
+		size_t bins = workers[0]->fft.bins();
+		// Shifted speaker frames don't line up with the cached layout
+		auto speakerCache = (leadSamples == 0) ? openSpeakerSpectra(speaker.size(), chunkSamples, chunkStep, bins) : nullptr;
+
+		// Estimate impulse on a per-frequency basis
+		runThreads(ranges.size(), [&](size_t thread) {
+			FrameWorker &worker = *workers[thread];
+			RealArray &extract = worker.extract;
+			worker.crossSum.fill(0);
+			worker.energy.fill(0);
+			for (size_t frame = ranges[thread].start; frame < ranges[thread].end; ++frame) {
+				size_t position = frame*chunkStep;
+				speakerFrame(speaker, (long)position - leadSamples, frame, window, worker, speakerCache.get());
+				
+				extract = mic.slice(position, chunkSamples, 1)*window;
+				worker.fft.fft(&extract[0], &worker.micSpectrum[0]);
 
-		std::ofstream myfile;
-		myfile.open (".items/" + itemId + ".impulse");
-		for (size_t i = 0; i < impulse.size(); i++) {
-			myfile << std::to_string(abs(impulse[i])) << std::endl;
+				worker.frameStore.write(&worker.speakerSpectrum[0], bins);
+				worker.frameStore.write(&worker.micSpectrum[0], bins);
+
+				for (size_t i = 0; i < bins; ++i) {
+					worker.crossSum[i] += worker.micSpectrum[i]*conj(worker.speakerSpectrum[i]);
+					worker.energy[i] += norm(worker.speakerSpectrum[i]);
+				}
+			}
+		});
+		DoubleComplexArray &crossSum = workers[0]->crossSum;
+		DoubleArray &speakerEnergy = workers[0]->energy;
+		for (size_t t = 1; t < workers.size(); ++t) {
+			crossSum += workers[t]->crossSum;
+			speakerEnergy += workers[t]->energy;
+		}
+
+		ComplexArray &impulseSpectrum = workspace.impulseSpectrum;
+		RealArray &impulse = workspace.impulse;
+		int peakIndex = estimateImpulse(workers[0]->fft, crossSum, speakerEnergy, impulseSpectrum, impulse);
+
+		int shiftSamples = leadSamples + peakIndex;
+
+		// Apply estimated impulse and subtract
+		for (auto &worker : workers) worker->frameStore.rewind();
+		overlapAddInPlace(mic, mic.size(), sharedLength, chunkSamples, chunkStep, shiftSamples, ranges, [&](size_t thread, size_t position) -> const RealArray & {
+			FrameWorker &worker = *workers[thread];
+			RealArray &extract = worker.extract;
+			if (!worker.frameStore.read(&worker.speakerSpectrum[0], bins) || !worker.frameStore.read(&worker.micSpectrum[0], bins)) {
+				speakerFrame(speaker, (long)position - leadSamples, position/chunkStep, window, worker, speakerCache.get());
+				
+				extract = mic.slice(position, chunkSamples, 1)*window;
+				worker.fft.fft(&extract[0], &worker.micSpectrum[0]);
+			}
+
+			for (size_t i = 0; i < bins; ++i) {
+				worker.micSpectrum[i] -= impulseSpectrum[i]*worker.speakerSpectrum[i];
+			}
+
+			worker.fft.ifft(&worker.micSpectrum[0], &extract[0]);
+			extract /= (Sample)chunkSamples;
+
+			extract *= window;
+			return extract;
+		});
+
+		for (auto &worker : workers) worker->frameStore.release();
+		if (speakerCache) speakerCache->save(speaker, window, workers[0]->fft, workers[0]->extract, workers[0]->speakerSpectrum);
+
+		if (keepDiagnostics) {
+			// Rotated by the lead, so it's the whole speaker-to-mic impulse
+			long rotation = leadSamples%(long)chunkSamples + (long)chunkSamples;
+			impulseDiagnostic.resize(chunkSamples);
+			for (size_t i = 0; i < chunkSamples; ++i) {
+				impulseDiagnostic[(i + rotation)%chunkSamples] = impulse[i];
+			}
+		} else {
+			impulseDiagnostic.clear();
 		}
-		myfile.close();
 
 		return shiftSamples;
 	}
@@ -157,52 +1014,77 @@ public:
 	template <typename Array1, typename Array2>
 	void energySuppression(Array1 &speaker, Array2 &mic, double strength) {
 		size_t chunkSamples = (int)(sampleRate*subtractionMs*0.001);
-		size_t chunkStep = chunkSamples/4;
-
-		ComplexArray extract(chunkSamples);
-		ComplexArray speakerSpectrum(chunkSamples), micSpectrum(chunkSamples);
+		size_t chunkStep = chunkSamples/overlap;
 
 		size_t sharedLength = std::min(speaker.size(), mic.size());
-		RealArray window = getWindow(chunkSamples, chunkStep);
-		signalsmith::FFT<double> fft(chunkSamples);
-		ComplexArray output(sharedLength);
-
-		RealArray subtractionCross(chunkSamples);
-		RealArray subtractionEnergy(chunkSamples);
-		subtractionCross.fill(0);
-		subtractionEnergy.fill(0);
-
-		output.fill(0);
-		for (size_t position = 0; position + chunkSamples < sharedLength; position += chunkStep) {
-			extract = speaker.slice(position, chunkSamples, 1)*window;
-			fft.fft(&extract[0], &speakerSpectrum[0]);
+		auto ranges = frameRanges(sharedLength, chunkSamples, chunkStep);
+		// The spectra are only revisited when the statistics are split across threads
+		Workspace &workspace = useWorkspace(chunkSamples, chunkStep, ranges.size(), ranges.size() > 1 ? spectrumCache : SpectrumCache::none);
+		const RealArray &window = *workspace.window;
+		std::vector<FrameWorker *> workers = workspace.workersFor(ranges.size());
+		size_t bins = workers[0]->fft.bins();
+		auto speakerCache = openSpeakerSpectra(speaker.size(), chunkSamples, chunkStep, bins);
+
+		auto transformFrame = [&](FrameWorker &worker, size_t position) {
+			RealArray &extract = worker.extract;
+			speakerFrame(speaker, position, position/chunkStep, window, worker, speakerCache.get());
 			
 			extract = mic.slice(position, chunkSamples, 1)*window;
-			fft.fft(&extract[0], &micSpectrum[0]);
+			worker.fft.fft(&extract[0], &worker.micSpectrum[0]);
+		};
 
-			for (size_t i = 1; i < chunkSamples/2; ++i) {
-				size_t i2 = chunkSamples - i;
-				double refEnergy = norm(speakerSpectrum[i]) + norm(speakerSpectrum[i2]);
-				
-				double micEnergy = norm(micSpectrum[i]) + norm(micSpectrum[i2]);
-				subtractionCross[i] += micEnergy*refEnergy;
-				subtractionEnergy[i] += refEnergy*refEnergy;
+		/* The suppression statistics are running sums, so each frame depends on all the ones before it.
+		With multiple threads, each one first totals the statistics for its own frames, and then starts from the sum of all earlier threads' totals. */
+		runThreads(ranges.size(), [&](size_t thread) {
+			FrameWorker &worker = *workers[thread];
+			worker.subtractionCross.fill(0);
+			worker.subtractionEnergy.fill(0);
+			if (ranges.size() == 1) return;
+			for (size_t frame = ranges[thread].start; frame < ranges[thread].end; ++frame) {
+				transformFrame(worker, frame*chunkStep);
+				worker.frameStore.write(&worker.speakerSpectrum[0], bins);
+				worker.frameStore.write(&worker.micSpectrum[0], bins);
+				for (size_t i = 1; i < chunkSamples/2; ++i) {
+					double refEnergy = 2*norm(worker.speakerSpectrum[i]);
+					double micEnergy = 2*norm(worker.micSpectrum[i]);
+					worker.subtractionCross[i] += micEnergy*refEnergy;
+					worker.subtractionEnergy[i] += refEnergy*refEnergy;
+				}
+			}
+			worker.frameStore.rewind();
+		});
+		DoubleArray runningCross(bins), runningEnergy(bins);
+		runningCross.fill(0);
+		runningEnergy.fill(0);
+		for (auto &worker : workers) {
+			// Swap each thread's totals for the running sum so far, element-wise
+			for (size_t i = 0; i < bins; ++i) {
+				double threadCross = worker->subtractionCross[i], threadEnergy = worker->subtractionEnergy[i];
+				worker->subtractionCross[i] = runningCross[i];
+				worker->subtractionEnergy[i] = runningEnergy[i];
+				runningCross[i] += threadCross;
+				runningEnergy[i] += threadEnergy;
+			}
+		}
 
-				double energyFactor = subtractionCross[i]/(subtractionEnergy[i]+1e-6);
-				double subtractedEnergy = micEnergy - strength*energyFactor*refEnergy;
-				double ampFactor = sqrt(std::max(0.0, subtractedEnergy)/(micEnergy+1e-6));
-				micSpectrum[i] *= ampFactor;
-				micSpectrum[i2] *= ampFactor;
+		overlapAddInPlace(mic, sharedLength, sharedLength, chunkSamples, chunkStep, 0, ranges, [&](size_t thread, size_t position) -> const RealArray & {
+			FrameWorker &worker = *workers[thread];
+			RealArray &extract = worker.extract;
+			if (!worker.frameStore.read(&worker.speakerSpectrum[0], bins) || !worker.frameStore.read(&worker.micSpectrum[0], bins)) {
+				transformFrame(worker, position);
 			}
 
-			fft.ifft(&micSpectrum[0], &extract[0]);
-			extract /= (double)chunkSamples;
+			suppressFrame(worker.speakerSpectrum, worker.micSpectrum, worker.subtractionCross, worker.subtractionEnergy, strength, chunkSamples);
 
-			output.slice(position, chunkSamples, 1) += extract*window;
-		}
-		for (size_t i = 0; i < output.size(); ++i) {
-			mic[i] = output[i].real();
-		}
+			worker.fft.ifft(&worker.micSpectrum[0], &extract[0]);
+			extract /= (Sample)chunkSamples;
+
+			extract *= window;
+			return extract;
+		});
+
+		for (auto &worker : workers) worker->frameStore.release();
+		if (speakerCache) speakerCache->save(speaker, window, workers[0]->fft, workers[0]->extract, workers[0]->speakerSpectrum);
 	}
 
 	template <typename Array1>
@@ -215,4 +1097,308 @@ public:
 			mic /= max;
 		}
 	}
+
+	/* Block-based canceller: feed paired speaker/mic blocks with write(), collect cancelled audio with read().
+
+	The impulse is re-estimated from all frames so far, every `impulseUpdateFrames` frames, so it's less accurate than cancel() near the start of a take.
+	Output is delayed by about one frame of each stage (impulseMs + subtractionMs), and isn't shifted by offsetSamples() or normalised.
+	*/
+	class Stream {
+		// Samples indexed from the start of the stream, discarding everything before `start`
+		class SampleQueue {
+			std::vector<Sample> samples;
+			size_t start = 0;
+		public:
+			size_t begin() const {
+				return start;
+			}
+			size_t end() const {
+				return start + samples.size();
+			}
+			void push(Sample value) {
+				samples.push_back(value);
+			}
+			Sample operator[](size_t index) const {
+				return samples[index - start];
+			}
+			void dropBefore(size_t index) {
+				if (index <= start) return;
+				size_t drop = std::min(index - start, samples.size());
+				samples.erase(samples.begin(), samples.begin() + drop);
+				start += drop;
+			}
+		};
+
+		EchoCanceller &canceller;
+		size_t impulseUpdateFrames = 4;
+
+		size_t linearChunk, linearStep;
+		signalsmith::RealFFT<Sample> linearFft;
+		std::shared_ptr<const RealArray> linearWindow;
+		DoubleComplexArray crossSum;
+		ComplexArray impulseSpectrum;
+		DoubleArray speakerEnergy;
+		RealArray impulse;
+		size_t linearFrames = 0;
+		int peakIndex = 0;
+
+		size_t suppressionChunk, suppressionStep;
+		signalsmith::RealFFT<Sample> suppressionFft;
+		std::shared_ptr<const RealArray> suppressionWindow;
+		DoubleArray subtractionCross, subtractionEnergy;
+
+		RealArray linearExtract, linearMicExtract, suppressionExtract;
+		ComplexArray speakerSpectrum, micSpectrum;
+
+		SampleQueue speaker, mic, linearOutput, output;
+		OverlapAdd linearSum, suppressionSum;
+		size_t linearPosition = 0, suppressionPosition = 0, readPosition = 0;
+		bool finished = false;
+
+		// Anything outside the queue (e.g. before the start of the stream) is treated as silence
+		static void windowFrame(const SampleQueue &queue, long position, const RealArray &window, RealArray &extract) {
+			for (size_t i = 0; i < window.size(); ++i) {
+				long index = position + (long)i;
+				bool valid = index >= (long)queue.begin() && index < (long)queue.end();
+				extract[i] = valid ? queue[index]*window[i] : 0;
+			}
+		}
+
+		void linearFrame() {
+			size_t bins = linearFft.bins();
+			RealArray &extract = linearExtract;
+			windowFrame(speaker, linearPosition, *linearWindow, extract);
+			windowFrame(mic, linearPosition, *linearWindow, linearMicExtract);
+			linearFft.fftPair(&extract[0], &linearMicExtract[0], &speakerSpectrum[0], &micSpectrum[0]);
+
+			for (size_t i = 0; i < bins; ++i) {
+				crossSum[i] += micSpectrum[i]*conj(speakerSpectrum[i]);
+				speakerEnergy[i] += norm(speakerSpectrum[i]);
+			}
+			if (linearFrames%impulseUpdateFrames == 0) {
+				peakIndex = canceller.estimateImpulse(linearFft, crossSum, speakerEnergy, impulseSpectrum, impulse);
+			}
+			++linearFrames;
+
+			for (size_t i = 0; i < bins; ++i) {
+				micSpectrum[i] -= impulseSpectrum[i]*speakerSpectrum[i];
+			}
+			linearFft.ifft(&micSpectrum[0], &extract[0]);
+			for (size_t i = 0; i < linearChunk; ++i) {
+				extract[i] *= (*linearWindow)[i]/(Sample)linearChunk;
+			}
+			linearSum.add(linearPosition, extract);
+
+			// No later frame touches anything before the next position
+			linearPosition += linearStep;
+			while (linearOutput.end() < linearPosition) {
+				linearOutput.push(linearSum[linearOutput.end()]);
+			}
+		}
+
+		void suppressionFrame() {
+			RealArray &extract = suppressionExtract;
+			// cancel() shifts the mic before suppression, so we line up the speaker instead
+			windowFrame(speaker, (long)suppressionPosition - peakIndex, *suppressionWindow, extract);
+			suppressionFft.fft(&extract[0], &speakerSpectrum[0]);
+			windowFrame(linearOutput, suppressionPosition, *suppressionWindow, extract);
+			suppressionFft.fft(&extract[0], &micSpectrum[0]);
+
+			canceller.suppressFrame(speakerSpectrum, micSpectrum, subtractionCross, subtractionEnergy, canceller.suppressionStrength, suppressionChunk);
+
+			suppressionFft.ifft(&micSpectrum[0], &extract[0]);
+			for (size_t i = 0; i < suppressionChunk; ++i) {
+				extract[i] *= (*suppressionWindow)[i]/(Sample)suppressionChunk;
+			}
+			suppressionSum.add(suppressionPosition, extract);
+
+			suppressionPosition += suppressionStep;
+			while (output.end() < suppressionPosition) {
+				output.push(suppressionSum[output.end()]);
+			}
+		}
+
+		void process() {
+			// Frames must end strictly before the available input, matching the batch loops
+			while (linearPosition + linearChunk < mic.end()) {
+				linearFrame();
+			}
+			while (suppressionPosition + suppressionChunk < linearOutput.end()) {
+				suppressionFrame();
+			}
+			// The speaker is read up to linearChunk/2 behind the suppression stage
+			size_t speakerNeeded = suppressionPosition - std::min(suppressionPosition, linearChunk/2 + 1);
+			speaker.dropBefore(std::min(linearPosition, speakerNeeded));
+			mic.dropBefore(linearPosition);
+			linearOutput.dropBefore(suppressionPosition);
+		}
+
+	public:
+		Stream(EchoCanceller &canceller) : canceller(canceller),
+				linearChunk(canceller.sampleRate*canceller.impulseMs*0.001), linearStep(linearChunk/canceller.overlap),
+				linearFft(linearChunk), linearWindow(canceller.getWindow(linearChunk, linearStep)),
+				crossSum(linearFft.bins()), impulseSpectrum(linearFft.bins()),
+				speakerEnergy(linearFft.bins()), impulse(linearChunk),
+				suppressionChunk(canceller.sampleRate*canceller.subtractionMs*0.001), suppressionStep(suppressionChunk/canceller.overlap),
+				suppressionFft(suppressionChunk), suppressionWindow(canceller.getWindow(suppressionChunk, suppressionStep)),
+				subtractionCross(suppressionChunk), subtractionEnergy(suppressionChunk),
+				linearExtract(linearChunk), linearMicExtract(linearChunk), suppressionExtract(suppressionChunk),
+				speakerSpectrum(linearFft.bins()), micSpectrum(linearFft.bins()),
+				linearSum(linearChunk), suppressionSum(suppressionChunk) {
+			crossSum.fill(0);
+			speakerEnergy.fill(0);
+			impulseSpectrum.fill(0);
+			subtractionCross.fill(0);
+			subtractionEnergy.fill(0);
+		}
+
+		// Paired blocks of the speaker (reference) and mic signals
+		void write(const float *speakerSamples, const float *micSamples, size_t length) {
+			if (finished) return;
+			for (size_t i = 0; i < length; ++i) {
+				speaker.push(speakerSamples[i]);
+				mic.push(micSamples[i]);
+			}
+			process();
+		}
+
+		// Flushes the tail of the take through both stages - no more input can be written afterwards
+		void finish() {
+			if (finished) return;
+			finished = true;
+			size_t length = mic.end();
+			while (linearOutput.end() < length) {
+				linearOutput.push(linearSum[linearOutput.end()]);
+			}
+			process();
+			while (output.end() < length) {
+				output.push(suppressionSum[output.end()]);
+			}
+		}
+
+		size_t available() const {
+			return output.end() - readPosition;
+		}
+		// Returns the number of cancelled samples copied into `samples`
+		size_t read(float *samples, size_t maxLength) {
+			size_t length = std::min(maxLength, available());
+			for (size_t i = 0; i < length; ++i) {
+				samples[i] = output[readPosition + i];
+			}
+			readPosition += length;
+			output.dropBefore(readPosition);
+			return length;
+		}
+
+		// Current estimate of the speaker-to-mic delay (as returned by cancel())
+		int offsetSamples() const {
+			return peakIndex;
+		}
+	};
+
+	/* Real-time canceller: a partitioned-block frequency-domain adaptive filter (MDF), adapted with a normalised LMS step every block.
+
+	The filter is `filterMs` long (covering any bulk delay as well as the echo tail), split into partitions of `blockSize`.
+	Each block costs three FFTs of 2*blockSize, plus two more to constrain one partition (round-robin), plus work proportional to the partition count.
+	Output has a fixed latency of `blockSize` samples, and isn't suppressed or normalised.
+	*/
+	class Live {
+		size_t blockSize, partitions, bins;
+		signalsmith::RealFFT<Sample> fft;
+		// Spectra are stored per partition: speaker history (newest first, as a ring) and the filter
+		std::vector<complex> history, filter;
+		DoubleArray power;
+		ComplexArray spectrum;
+		RealArray speakerFrame, time;
+		std::vector<Sample> micBlock, outputBlock;
+		size_t newest = 0, constrainNext = 0, blockIndex = 0, blocksSeen = 0;
+
+		const double stepSize = 0.5, powerSmoothing = 0.9;
+
+		complex * historyAt(size_t lag) {
+			return &history[((newest + lag)%partitions)*bins];
+		}
+
+		void processBlock() {
+			// Speaker spectrum from the last two blocks (overlap-save)
+			newest = (newest + partitions - 1)%partitions;
+			complex *speakerSpectrum = historyAt(0);
+			fft.fft(&speakerFrame[0], speakerSpectrum);
+			for (size_t i = 0; i < blockSize; ++i) {
+				speakerFrame[i] = speakerFrame[i + blockSize];
+			}
+			double weight = (blocksSeen++ == 0) ? 1 : 1 - powerSmoothing;
+			for (size_t i = 0; i < bins; ++i) {
+				power[i] += weight*(norm(speakerSpectrum[i]) - power[i]);
+			}
+
+			// Echo estimate: the last half of the (circular) filter output
+			spectrum.fill(0);
+			for (size_t p = 0; p < partitions; ++p) {
+				const complex *speakerP = historyAt(p), *filterP = &filter[p*bins];
+				for (size_t i = 0; i < bins; ++i) {
+					spectrum[i] += filterP[i]*speakerP[i];
+				}
+			}
+			fft.ifft(&spectrum[0], &time[0]);
+			Sample scale = 1/(Sample)(2*blockSize);
+			for (size_t i = 0; i < blockSize; ++i) {
+				outputBlock[i] = micBlock[i] - time[i + blockSize]*scale;
+				time[i] = 0;
+				time[i + blockSize] = outputBlock[i];
+			}
+
+			// Gradient step for every partition, normalised by the speaker power across the whole filter
+			fft.fft(&time[0], &spectrum[0]);
+			double regularise = 1e-6*2*blockSize;
+			for (size_t i = 0; i < bins; ++i) {
+				spectrum[i] *= (Sample)(stepSize/(partitions*power[i] + regularise));
+			}
+			for (size_t p = 0; p < partitions; ++p) {
+				const complex *speakerP = historyAt(p);
+				complex *filterP = &filter[p*bins];
+				for (size_t i = 0; i < bins; ++i) {
+					filterP[i] += conj(speakerP[i])*spectrum[i];
+				}
+			}
+
+			// Keep one partition's impulse to its first half, so the circular convolution stays linear
+			complex *filterP = &filter[constrainNext*bins];
+			fft.ifft(filterP, &time[0]);
+			for (size_t i = 0; i < blockSize; ++i) {
+				time[i] *= scale;
+				time[i + blockSize] = 0;
+			}
+			fft.fft(&time[0], filterP);
+			constrainNext = (constrainNext + 1)%partitions;
+		}
+
+	public:
+		Live(double sampleRate, size_t blockSize=256, double filterMs=250) : blockSize(blockSize),
+				partitions(std::max<size_t>(1, std::ceil(sampleRate*filterMs*0.001/blockSize))),
+				bins(blockSize + 1), fft(2*blockSize),
+				history(partitions*bins, 0), filter(partitions*bins, 0),
+				power(bins), spectrum(bins), speakerFrame(2*blockSize), time(2*blockSize),
+				micBlock(blockSize, 0), outputBlock(blockSize, 0) {
+			power.fill(0);
+			speakerFrame.fill(0);
+		}
+
+		// Cancelled output for each mic sample, delayed by blockSize() samples
+		void process(const float *speakerSamples, const float *micSamples, float *output, size_t length) {
+			for (size_t i = 0; i < length; ++i) {
+				output[i] = outputBlock[blockIndex];
+				speakerFrame[blockSize + blockIndex] = speakerSamples[i];
+				micBlock[blockIndex] = micSamples[i];
+				if (++blockIndex == blockSize) {
+					processBlock();
+					blockIndex = 0;
+				}
+			}
+		}
+
+		size_t latency() const {
+			return blockSize;
+		}
+	};
 };
\ No newline at end of file
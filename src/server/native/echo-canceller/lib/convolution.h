@@ -0,0 +1,103 @@
+#ifndef SIGNALSMITH_CONVOLUTION_H
+#define SIGNALSMITH_CONVOLUTION_H
+
+#include "fft.h"
+
+#include <vector>
+#include <complex>
+#include <algorithm>
+
+namespace signalsmith {
+	/* Streaming FIR filter with a fixed real impulse, using overlap-save.
+
+	Each block of blockSize() outputs costs one forward and one inverse real FFT, over the block plus the previous impulseLength() - 1 inputs.  There's no latency: a partial block is computed from what has arrived so far (and recomputed once the block fills up), so passing whole blocks is cheapest.
+
+	Convolution gives output[n] = sum(impulse[k]*input[n - k]).  Correlation reverses the reference, so output[n] = sum(reference[k]*input[n - length + 1 + k]), i.e. the reference's match against the input ending at n.
+	*/
+	template<typename V>
+	class Convolver {
+		using complex = std::complex<V>;
+
+		size_t _impulseLength = 0, _blockSize = 0, filled = 0;
+		RealFFT<V> fft;
+		std::vector<complex> impulseSpectrum, spectrum;
+		// The last impulseLength() - 1 inputs of the previous block, then the current block
+		std::vector<V> buffer, result;
+
+		void setSpectrum(const V *impulse, size_t length, size_t blockSize, bool reversed) {
+			_impulseLength = std::max<size_t>(length, 1);
+			if (blockSize == 0) blockSize = _impulseLength;
+			// Even, so the real FFT can use the half-size complex path
+			size_t fftSize = 2*FFT<V>::fastSizeAbove((blockSize + _impulseLength)/2);
+			_blockSize = fftSize - _impulseLength + 1;
+
+			fft.setSize(fftSize);
+			buffer.assign(fftSize, 0);
+			result.resize(fftSize);
+			for (size_t i = 0; i < length; ++i) {
+				buffer[i] = impulse[reversed ? length - 1 - i : i]/(V)fftSize; // undoes the unscaled inverse
+			}
+			impulseSpectrum.resize(fft.bins());
+			spectrum.resize(fft.bins());
+			fft.fft(buffer.data(), impulseSpectrum.data());
+			reset();
+		}
+
+		// Outputs for the `count` most recent inputs in the current block
+		void compute(V *output, size_t count) {
+			size_t history = _impulseLength - 1;
+			std::fill(buffer.begin() + history + filled, buffer.end(), 0);
+			fft.fft(buffer.data(), spectrum.data());
+			for (size_t i = 0; i < spectrum.size(); ++i) {
+				spectrum[i] *= impulseSpectrum[i];
+			}
+			// Aliasing from the circular convolution only lands on the history, so the block's outputs are exact
+			fft.ifft(spectrum.data(), result.data());
+			std::copy(result.begin() + history + filled - count, result.begin() + history + filled, output);
+		}
+
+	public:
+		Convolver() : fft(2) {}
+
+		// A block size of 0 picks one about the same length as the impulse
+		void setImpulse(const V *impulse, size_t length, size_t blockSize=0) {
+			setSpectrum(impulse, length, blockSize, false);
+		}
+		void setCorrelation(const V *reference, size_t length, size_t blockSize=0) {
+			setSpectrum(reference, length, blockSize, true);
+		}
+
+		size_t impulseLength() const {
+			return _impulseLength;
+		}
+		size_t blockSize() const {
+			return _blockSize;
+		}
+
+		// Clears the input history, as if preceded by silence
+		void reset() {
+			std::fill(buffer.begin(), buffer.end(), 0);
+			filled = 0;
+		}
+
+		void process(const V *input, V *output, size_t length) {
+			size_t history = _impulseLength - 1;
+			while (length > 0) {
+				size_t count = std::min(length, _blockSize - filled);
+				std::copy(input, input + count, buffer.begin() + history + filled);
+				filled += count;
+				compute(output, count);
+				input += count;
+				output += count;
+				length -= count;
+
+				if (filled == _blockSize) {
+					std::copy(buffer.begin() + _blockSize, buffer.begin() + _blockSize + history, buffer.begin());
+					filled = 0;
+				}
+			}
+		}
+	};
+}
+
+#endif
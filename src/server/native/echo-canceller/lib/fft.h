@@ -1,12 +1,52 @@
+#ifndef SIGNALSMITH_FFT_H
+#define SIGNALSMITH_FFT_H
+
 #include <vector>
 #include <complex>
 #include <cmath>
 #include <array>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <map>
 
 #ifndef SIGNALSMITH_INLINE
 #define SIGNALSMITH_INLINE /*__attribute__((always_inline))*/ inline
 #endif
 
+/* Vector butterflies use SSE2 (the x86-64 baseline), or AVX/AVX-512 when CPUID says the host has them.
+Those kernels are compiled alongside the baseline ones using target attributes, so the build itself needs no -m flags.  Other targets use the scalar code. */
+#ifndef SIGNALSMITH_FFT_NO_SIMD
+#	if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#		define SIGNALSMITH_FFT_SSE2
+#		if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#			define SIGNALSMITH_FFT_DISPATCH
+#			define SIGNALSMITH_FFT_TARGET(isa) __attribute__((target(isa)))
+			// Inlines everything the kernel calls, so none of it falls back to the baseline instruction set
+#			define SIGNALSMITH_FFT_TARGET_KERNEL(isa) __attribute__((target(isa), flatten))
+#		elif defined(_MSC_VER)
+#			define SIGNALSMITH_FFT_DISPATCH
+#			define SIGNALSMITH_FFT_TARGET(isa)
+#			define SIGNALSMITH_FFT_TARGET_KERNEL(isa)
+#		endif
+#	endif
+#endif
+#if defined(SIGNALSMITH_FFT_DISPATCH)
+#	include <immintrin.h>
+#	if defined(_MSC_VER) && !defined(__clang__)
+#		include <intrin.h>
+#	else
+#		include <cpuid.h>
+#	endif
+#elif defined(SIGNALSMITH_FFT_SSE2)
+#	include <emmintrin.h>
+#endif
+#if defined(SIGNALSMITH_FFT_DISPATCH) && defined(__GNUC__) && !defined(__clang__)
+	// Pack arithmetic is only ever inlined into the matching kernel, so the ABI for passing wider vectors between functions doesn't apply
+#	pragma GCC diagnostic push
+#	pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
 namespace signalsmith {
 
 	namespace perf {
@@ -32,222 +72,931 @@ namespace signalsmith {
 				a.imag() + b.real()
 			};
 		}
+
+		/* Packs hold `lanes` consecutive complex values split into real and imaginary registers.
+
+		loadComplex() reads them from interleaved memory, storeComplex() writes them back contiguously, and storeStrided() writes lane j to `output + j*stride`.
+		*/
+		template<typename V>
+		struct ScalarPack {
+			using Reg = V;
+			static constexpr size_t lanes = 1;
+			static SIGNALSMITH_INLINE Reg set(V v) {return v;}
+			static SIGNALSMITH_INLINE Reg load(const V *v) {return *v;}
+			static SIGNALSMITH_INLINE void store(V *v, Reg a) {*v = a;}
+			static SIGNALSMITH_INLINE Reg add(Reg a, Reg b) {return a + b;}
+			static SIGNALSMITH_INLINE Reg sub(Reg a, Reg b) {return a - b;}
+			static SIGNALSMITH_INLINE Reg mul(Reg a, Reg b) {return a*b;}
+			static SIGNALSMITH_INLINE void loadComplex(const std::complex<V> *input, Reg &re, Reg &im) {
+				re = input->real();
+				im = input->imag();
+			}
+			static SIGNALSMITH_INLINE void storeComplex(std::complex<V> *output, Reg re, Reg im) {
+				*output = {re, im};
+			}
+			static SIGNALSMITH_INLINE void storeStrided(std::complex<V> *output, size_t, Reg re, Reg im) {
+				*output = {re, im};
+			}
+		};
+		// Each instruction set's packs, with ScalarPack for any other value type
+		template<typename V>
+		struct Sse2Pack : public ScalarPack<V> {};
+		template<typename V>
+		struct AvxPack : public ScalarPack<V> {};
+		template<typename V>
+		struct Avx512Pack : public ScalarPack<V> {};
+
+#if defined(SIGNALSMITH_FFT_SSE2)
+		template<>
+		struct Sse2Pack<double> {
+			using Reg = __m128d;
+			static constexpr size_t lanes = 2;
+			static SIGNALSMITH_INLINE Reg set(double v) {return _mm_set1_pd(v);}
+			static SIGNALSMITH_INLINE Reg load(const double *v) {return _mm_loadu_pd(v);}
+			static SIGNALSMITH_INLINE void store(double *v, Reg a) {_mm_storeu_pd(v, a);}
+			static SIGNALSMITH_INLINE Reg add(Reg a, Reg b) {return _mm_add_pd(a, b);}
+			static SIGNALSMITH_INLINE Reg sub(Reg a, Reg b) {return _mm_sub_pd(a, b);}
+			static SIGNALSMITH_INLINE Reg mul(Reg a, Reg b) {return _mm_mul_pd(a, b);}
+			static SIGNALSMITH_INLINE void loadComplex(const std::complex<double> *input, Reg &re, Reg &im) {
+				const double *v = reinterpret_cast<const double *>(input);
+				Reg a = _mm_loadu_pd(v), b = _mm_loadu_pd(v + 2);
+				re = _mm_unpacklo_pd(a, b);
+				im = _mm_unpackhi_pd(a, b);
+			}
+			static SIGNALSMITH_INLINE void storeComplex(std::complex<double> *output, Reg re, Reg im) {
+				double *v = reinterpret_cast<double *>(output);
+				_mm_storeu_pd(v, _mm_unpacklo_pd(re, im));
+				_mm_storeu_pd(v + 2, _mm_unpackhi_pd(re, im));
+			}
+			static SIGNALSMITH_INLINE void storeStrided(std::complex<double> *output, size_t stride, Reg re, Reg im) {
+				_mm_storeu_pd(reinterpret_cast<double *>(output), _mm_unpacklo_pd(re, im));
+				_mm_storeu_pd(reinterpret_cast<double *>(output + stride), _mm_unpackhi_pd(re, im));
+			}
+		};
+		template<>
+		struct Sse2Pack<float> {
+			using Reg = __m128;
+			static constexpr size_t lanes = 4;
+			static SIGNALSMITH_INLINE Reg set(float v) {return _mm_set1_ps(v);}
+			static SIGNALSMITH_INLINE Reg load(const float *v) {return _mm_loadu_ps(v);}
+			static SIGNALSMITH_INLINE void store(float *v, Reg a) {_mm_storeu_ps(v, a);}
+			static SIGNALSMITH_INLINE Reg add(Reg a, Reg b) {return _mm_add_ps(a, b);}
+			static SIGNALSMITH_INLINE Reg sub(Reg a, Reg b) {return _mm_sub_ps(a, b);}
+			static SIGNALSMITH_INLINE Reg mul(Reg a, Reg b) {return _mm_mul_ps(a, b);}
+			static SIGNALSMITH_INLINE void loadComplex(const std::complex<float> *input, Reg &re, Reg &im) {
+				const float *v = reinterpret_cast<const float *>(input);
+				Reg a = _mm_loadu_ps(v), b = _mm_loadu_ps(v + 4);
+				re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+				im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			}
+			static SIGNALSMITH_INLINE void storeComplex(std::complex<float> *output, Reg re, Reg im) {
+				float *v = reinterpret_cast<float *>(output);
+				_mm_storeu_ps(v, _mm_unpacklo_ps(re, im));
+				_mm_storeu_ps(v + 4, _mm_unpackhi_ps(re, im));
+			}
+			static SIGNALSMITH_INLINE void storeStrided(std::complex<float> *output, size_t stride, Reg re, Reg im) {
+				Reg low = _mm_unpacklo_ps(re, im), high = _mm_unpackhi_ps(re, im);
+				_mm_storel_pi(reinterpret_cast<__m64 *>(output), low);
+				_mm_storeh_pi(reinterpret_cast<__m64 *>(output + stride), low);
+				_mm_storel_pi(reinterpret_cast<__m64 *>(output + stride*2), high);
+				_mm_storeh_pi(reinterpret_cast<__m64 *>(output + stride*3), high);
+			}
+		};
+#endif
+#if defined(SIGNALSMITH_FFT_DISPATCH)
+		template<>
+		struct AvxPack<double> {
+			using Reg = __m256d;
+			static constexpr size_t lanes = 4;
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg set(double v) {return _mm256_set1_pd(v);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg load(const double *v) {return _mm256_loadu_pd(v);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void store(double *v, Reg a) {_mm256_storeu_pd(v, a);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg add(Reg a, Reg b) {return _mm256_add_pd(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg sub(Reg a, Reg b) {return _mm256_sub_pd(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg mul(Reg a, Reg b) {return _mm256_mul_pd(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void loadComplex(const std::complex<double> *input, Reg &re, Reg &im) {
+				const double *v = reinterpret_cast<const double *>(input);
+				Reg a = _mm256_loadu_pd(v), b = _mm256_loadu_pd(v + 4);
+				// [0 2 | 1 3] ordering, so the unpacks come out in lane order
+				Reg evens = _mm256_permute2f128_pd(a, b, 0x20), odds = _mm256_permute2f128_pd(a, b, 0x31);
+				re = _mm256_unpacklo_pd(evens, odds);
+				im = _mm256_unpackhi_pd(evens, odds);
+			}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void storeComplex(std::complex<double> *output, Reg re, Reg im) {
+				Reg evens = _mm256_unpacklo_pd(re, im), odds = _mm256_unpackhi_pd(re, im);
+				double *v = reinterpret_cast<double *>(output);
+				_mm256_storeu_pd(v, _mm256_permute2f128_pd(evens, odds, 0x20));
+				_mm256_storeu_pd(v + 4, _mm256_permute2f128_pd(evens, odds, 0x31));
+			}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void storeStrided(std::complex<double> *output, size_t stride, Reg re, Reg im) {
+				Reg evens = _mm256_unpacklo_pd(re, im), odds = _mm256_unpackhi_pd(re, im);
+				_mm_storeu_pd(reinterpret_cast<double *>(output), _mm256_castpd256_pd128(evens));
+				_mm_storeu_pd(reinterpret_cast<double *>(output + stride), _mm256_castpd256_pd128(odds));
+				_mm_storeu_pd(reinterpret_cast<double *>(output + stride*2), _mm256_extractf128_pd(evens, 1));
+				_mm_storeu_pd(reinterpret_cast<double *>(output + stride*3), _mm256_extractf128_pd(odds, 1));
+			}
+		};
+		template<>
+		struct AvxPack<float> {
+			using Reg = __m256;
+			static constexpr size_t lanes = 8;
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg set(float v) {return _mm256_set1_ps(v);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg load(const float *v) {return _mm256_loadu_ps(v);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void store(float *v, Reg a) {_mm256_storeu_ps(v, a);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg add(Reg a, Reg b) {return _mm256_add_ps(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg sub(Reg a, Reg b) {return _mm256_sub_ps(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE Reg mul(Reg a, Reg b) {return _mm256_mul_ps(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void loadComplex(const std::complex<float> *input, Reg &re, Reg &im) {
+				const float *v = reinterpret_cast<const float *>(input);
+				Reg a = _mm256_loadu_ps(v), b = _mm256_loadu_ps(v + 8);
+				Reg low = _mm256_permute2f128_ps(a, b, 0x20), high = _mm256_permute2f128_ps(a, b, 0x31);
+				re = _mm256_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+				im = _mm256_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+			}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void storeComplex(std::complex<float> *output, Reg re, Reg im) {
+				Reg low = _mm256_unpacklo_ps(re, im), high = _mm256_unpackhi_ps(re, im);
+				float *v = reinterpret_cast<float *>(output);
+				_mm256_storeu_ps(v, _mm256_permute2f128_ps(low, high, 0x20));
+				_mm256_storeu_ps(v + 8, _mm256_permute2f128_ps(low, high, 0x31));
+			}
+			SIGNALSMITH_FFT_TARGET("avx") static SIGNALSMITH_INLINE void storeStrided(std::complex<float> *output, size_t stride, Reg re, Reg im) {
+				Reg low = _mm256_unpacklo_ps(re, im), high = _mm256_unpackhi_ps(re, im);
+				__m128 parts[4] = {_mm256_castps256_ps128(low), _mm256_castps256_ps128(high), _mm256_extractf128_ps(low, 1), _mm256_extractf128_ps(high, 1)};
+				for (int i = 0; i < 4; ++i) {
+					_mm_storel_pi(reinterpret_cast<__m64 *>(output + stride*2*i), parts[i]);
+					_mm_storeh_pi(reinterpret_cast<__m64 *>(output + stride*(2*i + 1)), parts[i]);
+				}
+			}
+		};
+		template<>
+		struct Avx512Pack<double> {
+			using Reg = __m512d;
+			static constexpr size_t lanes = 8;
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg set(double v) {return _mm512_set1_pd(v);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg load(const double *v) {return _mm512_loadu_pd(v);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void store(double *v, Reg a) {_mm512_storeu_pd(v, a);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg add(Reg a, Reg b) {return _mm512_add_pd(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg sub(Reg a, Reg b) {return _mm512_sub_pd(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg mul(Reg a, Reg b) {return _mm512_mul_pd(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void loadComplex(const std::complex<double> *input, Reg &re, Reg &im) {
+				const double *v = reinterpret_cast<const double *>(input);
+				Reg a = _mm512_loadu_pd(v), b = _mm512_loadu_pd(v + 8);
+				re = _mm512_permutex2var_pd(a, _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14), b);
+				im = _mm512_permutex2var_pd(a, _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15), b);
+			}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void storeComplex(std::complex<double> *output, Reg re, Reg im) {
+				double *v = reinterpret_cast<double *>(output);
+				_mm512_storeu_pd(v, _mm512_permutex2var_pd(re, _mm512_setr_epi64(0, 8, 1, 9, 2, 10, 3, 11), im));
+				_mm512_storeu_pd(v + 8, _mm512_permutex2var_pd(re, _mm512_setr_epi64(4, 12, 5, 13, 6, 14, 7, 15), im));
+			}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void storeStrided(std::complex<double> *output, size_t stride, Reg re, Reg im) {
+				alignas(64) double interleaved[16];
+				_mm512_store_pd(interleaved, _mm512_permutex2var_pd(re, _mm512_setr_epi64(0, 8, 1, 9, 2, 10, 3, 11), im));
+				_mm512_store_pd(interleaved + 8, _mm512_permutex2var_pd(re, _mm512_setr_epi64(4, 12, 5, 13, 6, 14, 7, 15), im));
+				for (size_t j = 0; j < lanes; ++j) {
+					output[j*stride] = {interleaved[2*j], interleaved[2*j + 1]};
+				}
+			}
+		};
+		template<>
+		struct Avx512Pack<float> {
+			using Reg = __m512;
+			static constexpr size_t lanes = 16;
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg set(float v) {return _mm512_set1_ps(v);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg load(const float *v) {return _mm512_loadu_ps(v);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void store(float *v, Reg a) {_mm512_storeu_ps(v, a);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg add(Reg a, Reg b) {return _mm512_add_ps(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg sub(Reg a, Reg b) {return _mm512_sub_ps(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE Reg mul(Reg a, Reg b) {return _mm512_mul_ps(a, b);}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void loadComplex(const std::complex<float> *input, Reg &re, Reg &im) {
+				const float *v = reinterpret_cast<const float *>(input);
+				Reg a = _mm512_loadu_ps(v), b = _mm512_loadu_ps(v + 16);
+				re = _mm512_permutex2var_ps(a, _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30), b);
+				im = _mm512_permutex2var_ps(a, _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31), b);
+			}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void storeComplex(std::complex<float> *output, Reg re, Reg im) {
+				float *v = reinterpret_cast<float *>(output);
+				_mm512_storeu_ps(v, _mm512_permutex2var_ps(re, _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23), im));
+				_mm512_storeu_ps(v + 16, _mm512_permutex2var_ps(re, _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31), im));
+			}
+			SIGNALSMITH_FFT_TARGET("avx512f") static SIGNALSMITH_INLINE void storeStrided(std::complex<float> *output, size_t stride, Reg re, Reg im) {
+				alignas(64) float interleaved[32];
+				_mm512_store_ps(interleaved, _mm512_permutex2var_ps(re, _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23), im));
+				_mm512_store_ps(interleaved + 16, _mm512_permutex2var_ps(re, _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31), im));
+				for (size_t j = 0; j < lanes; ++j) {
+					output[j*stride] = {interleaved[2*j], interleaved[2*j + 1]};
+				}
+			}
+		};
+
+		// Reads CPUID leaf/subleaf as {eax, ebx, ecx, edx}
+		inline std::array<unsigned int, 4> cpuid(unsigned int leaf, unsigned int subleaf) {
+			std::array<unsigned int, 4> registers{{0, 0, 0, 0}};
+#	if defined(_MSC_VER) && !defined(__clang__)
+			int values[4];
+			__cpuidex(values, (int)leaf, (int)subleaf);
+			for (int i = 0; i < 4; ++i) registers[i] = (unsigned int)values[i];
+#	else
+			__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#	endif
+			return registers;
+		}
+		// Register state the OS saves on context switches (XCR0)
+		inline unsigned long long enabledRegisterState() {
+#	if defined(_MSC_VER) && !defined(__clang__)
+			return _xgetbv(0);
+#	else
+			unsigned int low, high;
+			__asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+			return ((unsigned long long)high << 32) | low;
+#	endif
+		}
+		// 2 for AVX-512F, 1 for AVX, 0 for neither - each needs both the CPU and the OS to support it
+		inline int detectSimdLevel() {
+			unsigned int maxLeaf = cpuid(0, 0)[0];
+			std::array<unsigned int, 4> features = cpuid(1, 0);
+			bool osSavesState = features[2] & (1u << 27), avx = features[2] & (1u << 28);
+			if (!osSavesState || !avx) return 0;
+			unsigned long long state = enabledRegisterState();
+			if ((state & 0x6) != 0x6) return 0; // XMM and YMM
+			bool avx512 = maxLeaf >= 7 && (cpuid(7, 0)[1] & (1u << 16));
+			return (avx512 && (state & 0xe6) == 0xe6) ? 2 : 1; // plus opmask and ZMM
+		}
+		inline int simdLevel() {
+			static const int level = detectSimdLevel();
+			return level;
+		}
+#endif
+
+		// Complex arithmetic on packs, matching complexMul() and complexAddI() lane-by-lane
+		template<class Pack>
+		struct Split {
+			using Reg = typename Pack::Reg;
+			Reg re, im;
+
+			SIGNALSMITH_INLINE Split operator+(const Split &other) const {
+				return {Pack::add(re, other.re), Pack::add(im, other.im)};
+			}
+			SIGNALSMITH_INLINE Split operator-(const Split &other) const {
+				return {Pack::sub(re, other.re), Pack::sub(im, other.im)};
+			}
+			SIGNALSMITH_INLINE Split operator*(const Reg &scale) const {
+				return {Pack::mul(re, scale), Pack::mul(im, scale)};
+			}
+		};
+		template <bool conjugateSecond, class Pack>
+		SIGNALSMITH_INLINE Split<Pack> complexMul(const Split<Pack> &a, const Split<Pack> &b) {
+			return conjugateSecond ? Split<Pack>{
+				Pack::add(Pack::mul(b.re, a.re), Pack::mul(b.im, a.im)),
+				Pack::sub(Pack::mul(b.re, a.im), Pack::mul(b.im, a.re))
+			} : Split<Pack>{
+				Pack::sub(Pack::mul(a.re, b.re), Pack::mul(a.im, b.im)),
+				Pack::add(Pack::mul(a.re, b.im), Pack::mul(a.im, b.re))
+			};
+		}
+		template<bool flipped, class Pack>
+		SIGNALSMITH_INLINE Split<Pack> complexAddI(const Split<Pack> &a, const Split<Pack> &b) {
+			return flipped ? Split<Pack>{
+				Pack::add(a.re, b.im),
+				Pack::sub(a.im, b.re)
+			} : Split<Pack>{
+				Pack::sub(a.re, b.im),
+				Pack::add(a.im, b.re)
+			};
+		}
 	}
 
+	template<typename V, size_t fixedSize>
+	class FixedFFT;
+
 	template<typename V>
 	class FFT {
 		using complex = std::complex<V>;
-		size_t _size;
-		std::vector<complex> working;
+	public:
+		/* Factorisation, twiddles and (for large primes) Bluestein chirps for one size.
 
-		struct Step {
-			size_t N;
-			size_t twiddleOffset;
-			size_t twiddleRepeats;
-		};
-		std::vector<Step> plan;
-		std::vector<complex> twiddles;
-		std::vector<int> permutation;
-		void setPlan() {
-			plan.resize(0);
-			twiddles.resize(0);
-			size_t size = _size;
-			while (size > 1) {
-				size_t stepSize = size;
-				if (size%4 == 0) {
-					stepSize = 4;
-				} else {
-					for (size_t divisor = 2; divisor <= sqrt(size); ++divisor) {
-						if (size%divisor == 0) {
-							stepSize = divisor;
-							break;
-						}
+		A plan never changes after construction, so any number of threads can run it at once, each passing its own working buffer of workingSize() values.
+		*/
+		class Plan {
+			size_t _size;
+
+			struct Step {
+				size_t N;
+				size_t twiddleOffset;
+				size_t twiddleRepeats;
+				size_t rotationOffset; // generic steps only: the N roots of unity
+			};
+			std::vector<Step> steps;
+			std::vector<complex> twiddles;
+
+			// Radix, transform size and twiddle repeats for one step: known at runtime, or (for FixedFFT) compile-time constants
+			struct RuntimeShape {
+				size_t N, size, repeats;
+			};
+			template<size_t stepN, size_t stepSize, size_t stepRepeats>
+			struct FixedShape {
+				static constexpr size_t N = stepN, size = stepSize, repeats = stepRepeats;
+			};
+			template<typename, size_t>
+			friend class FixedFFT;
+			std::vector<complex> rotations;
+
+			// Generic steps cost O(N*p) per prime, so larger primes always use Bluestein's algorithm (and smaller ones when its estimate is cheaper)
+			static constexpr size_t genericMaxPrime = 128;
+			std::shared_ptr<const Plan> bluesteinPlan; // power-of-two size, for the chirp convolution
+			std::vector<complex> bluesteinChirp, bluesteinSpectrum;
+
+			static size_t bluesteinSize(size_t size) {
+				size_t convolutionSize = 1;
+				while (convolutionSize < 2*size - 1) convolutionSize *= 2;
+				return convolutionSize;
+			}
+
+			/* Estimated costs, in radix-2 passes over the data.  A generic step of prime p is about 2p passes, and Bluestein's padded power-of-two convolution is about 6 passes of its (2-4x larger) size.
+			Measured with doubles: 551 = 19*29 takes 53us directly and 134us with Bluestein, 20677 = 23*29*31 takes 3.8ms and 6.6ms, and 101 takes 50us and 17us. */
+			static bool useBluestein(size_t size) {
+				if (size < 2) return false;
+				double directCost = std::log2((double)size);
+				size_t remaining = size;
+				for (size_t divisor = 2; divisor*divisor <= remaining; ++divisor) {
+					while (remaining%divisor == 0) {
+						if (divisor > genericMaxPrime) return true;
+						if (divisor > 7) directCost += 2.0*divisor;
+						remaining /= divisor;
 					}
 				}
-				size_t twiddleRepeats = _size/size;
-				// Calculate twiddles
-				size_t twiddleOffset = twiddles.size();
-				double phaseStep = 2*M_PI/size;
-				for (size_t i = 0; i < size/stepSize; i++) {
-					for (size_t bin = 0; bin < stepSize; bin++) {
-						double twiddlePhase = phaseStep*bin*i;
-						twiddles.push_back({cos(twiddlePhase), -sin(twiddlePhase)});
+				if (remaining > genericMaxPrime) return true;
+				if (remaining > 7) directCost += 2.0*remaining;
+
+				size_t convolutionSize = bluesteinSize(size);
+				double bluesteinCost = 6.0*convolutionSize*std::log2((double)convolutionSize)/size;
+				return bluesteinCost < directCost;
+			}
+
+			void setBluestein() {
+				size_t convolutionSize = bluesteinSize(_size);
+				bluesteinPlan = forSize(convolutionSize);
+				bluesteinSpectrum.resize(convolutionSize);
+
+				// chirp[n] = e^{-i*pi*n^2/N}, with n^2 reduced mod 2N to keep the phase accurate
+				bluesteinChirp.resize(_size);
+				for (size_t n = 0; n < _size; ++n) {
+					double phase = M_PI*(double)((n*n)%(2*_size))/_size;
+					bluesteinChirp[n] = {(V)cos(phase), (V)-sin(phase)};
+				}
+
+				// Spectrum of the conjugate chirp (wrapped for circular convolution), scaled to undo the unscaled inverse
+				std::vector<complex> conjChirp(convolutionSize, 0), working(bluesteinPlan->workingSize());
+				conjChirp[0] = std::conj(bluesteinChirp[0]);
+				for (size_t n = 1; n < _size; ++n) {
+					conjChirp[n] = conjChirp[convolutionSize - n] = std::conj(bluesteinChirp[n]);
+				}
+				bluesteinPlan->template run<false>(conjChirp.data(), bluesteinSpectrum.data(), working.data());
+				for (auto &v : bluesteinSpectrum) v *= (V)1/convolutionSize;
+			}
+
+			/* Compile-time steps from FixedFFT, for any sizes listed (comma-separated) in SIGNALSMITH_FFT_UNROLLED_SIZES.
+			Each size adds to the compile time of every V, so there are none unless the application lists its own. */
+			using UnrolledRun = void (*)(complex const *input, complex *output, complex *working, const complex *twiddles);
+			UnrolledRun unrolledForward = nullptr, unrolledInverse = nullptr;
+			template<size_t... sizes>
+			struct SizeList {};
+#ifdef SIGNALSMITH_FFT_UNROLLED_SIZES
+			using UnrolledSizes = SizeList<SIGNALSMITH_FFT_UNROLLED_SIZES>;
+#else
+			using UnrolledSizes = SizeList<>;
+#endif
+
+			void setUnrolled(SizeList<>) {}
+			template<size_t fixedSize, size_t... others>
+			void setUnrolled(SizeList<fixedSize, others...>) {
+				if (_size != fixedSize) return setUnrolled(SizeList<others...>());
+				unrolledForward = &FixedFFT<V, fixedSize>::template runUnrolled<false>;
+				unrolledInverse = &FixedFFT<V, fixedSize>::template runUnrolled<true>;
+			}
+
+			void setPlan() {
+				if (useBluestein(_size)) {
+					return setBluestein();
+				}
+				size_t size = _size;
+				while (size > 1) {
+					size_t stepSize = size;
+					if (size%4 == 0) {
+						stepSize = 4;
+					} else {
+						for (size_t divisor = 2; divisor <= sqrt(size); ++divisor) {
+							if (size%divisor == 0) {
+								stepSize = divisor;
+								break;
+							}
+						}
 					}
-				}	
-
-				plan.push_back({stepSize, twiddleOffset, twiddleRepeats});
-				size /= stepSize;
-			}
-
-			// Construct permutation from factorised sizes
-			permutation.resize(1);
-			permutation[0] = 0;
-			for (int i = plan.size() - 1; i >= 0; --i) {
-				const Step &step = plan[i];
-				size_t pSize = permutation.size();
-				size_t stride = _size/pSize/step.N;
-				for (size_t i = 1; i < step.N; i++) {
-					for (size_t j = 0; j < pSize; j++) {
-						permutation.push_back(permutation[j] + i*stride);
+					size_t twiddleRepeats = _size/size;
+					// Calculate twiddles
+					size_t twiddleOffset = twiddles.size();
+					double phaseStep = 2*M_PI/size;
+					for (size_t i = 0; i < size/stepSize; i++) {
+						for (size_t bin = 0; bin < stepSize; bin++) {
+							double twiddlePhase = phaseStep*bin*i;
+							twiddles.push_back({(V)cos(twiddlePhase), (V)-sin(twiddlePhase)});
+						}
+					}	
+
+					size_t rotationOffset = rotations.size();
+					if (stepSize > 5 && stepSize != 7) { // no dedicated step
+						for (size_t i = 0; i < stepSize; ++i) {
+							double phase = 2*M_PI*i/stepSize;
+							rotations.push_back({(V)cos(phase), (V)-sin(phase)});
+						}
 					}
+
+					steps.push_back({stepSize, twiddleOffset, twiddleRepeats, rotationOffset});
+					size /= stepSize;
 				}
+				setUnrolled(UnrolledSizes());
 			}
-		}
 
-		template<bool inverse>
-		void fftStepGeneric(complex const *input, complex *output, const Step &step) {
-			size_t stepSize = step.N;
-			const complex *twiddles = &this->twiddles[step.twiddleOffset];
-
-			size_t stride = _size/stepSize;
-			const complex *end = input + stride;
-			while (input != end) {
-				for (size_t repeat = 0; repeat < step.twiddleRepeats; ++repeat) {
-					for (size_t bin = 0; bin < stepSize; ++bin) {
-						complex sum = input[0];
-						for (size_t i = 1; i < stepSize; ++i) {
-							V phase = 2*M_PI*bin*i/stepSize;
-							complex factor = {cos(phase), -sin(phase)};
-							sum += perf::complexMul<inverse>(input[i*stride], factor);
+			template<bool inverse>
+			void fftStepGeneric(complex const *input, complex *output, const Step &step) const {
+				size_t stepSize = step.N;
+				const complex *twiddles = &this->twiddles[step.twiddleOffset];
+				size_t repeats = step.twiddleRepeats;
+				const complex *rotations = &this->rotations[step.rotationOffset];
+
+				size_t stride = _size/stepSize;
+				const complex *end = input + stride;
+				while (input != end) {
+					for (size_t repeat = 0; repeat < repeats; ++repeat) {
+						for (size_t bin = 0; bin < stepSize; ++bin) {
+							complex sum = input[0];
+							// Rotation by bin*i/stepSize of a turn, kept as a table index
+							size_t rotation = 0;
+							for (size_t i = 1; i < stepSize; ++i) {
+								rotation += bin;
+								if (rotation >= stepSize) rotation -= stepSize;
+								sum += perf::complexMul<inverse>(input[i*stride], rotations[rotation]);
+							}
+
+							output[repeats*bin] = perf::complexMul<inverse>(sum, twiddles[bin]);
 						}
+						++input;
+						++output;
+					}
+					twiddles += stepSize;
+					output += repeats*(stepSize - 1);
+				}
+			}
+
+			template<bool inverse, class Shape>
+			static void fftStep2(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				size_t repeats = shape.repeats;
+				size_t stride = shape.size/2;
+
+				complex const *end = input + stride;
+				while (input != end) {
+					for (size_t repeat = 0; repeat < repeats; ++repeat) {
+						complex A = input[0], B = input[stride];
 
-						output[bin] = perf::complexMul<inverse>(sum, twiddles[bin]);
+						output[0] = A + B;
+						output[repeats] = perf::complexMul<inverse>(A - B, twiddles[1]);
+						++input;
+						++output;
 					}
-					++input;
-					output += stepSize;
+					twiddles += 2;
+					output += repeats;
 				}
-				twiddles += stepSize;
 			}
-		}
 
-		template<bool inverse>
-		void fftStep2(complex const *input, complex *output, const Step &step) {
-			const complex *twiddles = &this->twiddles[step.twiddleOffset];
-			size_t stride = _size/2;
+			template<bool inverse, class Shape>
+			static void fftStep3(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				const complex factor3 = {-0.5, inverse ? 0.8660254037844386 : -0.8660254037844386};
+
+				size_t repeats = shape.repeats;
+				size_t stride = shape.size/3;
 
-			complex const *end = input + stride;
-			while (input != end) {
-				for (size_t repeat = 0; repeat < step.twiddleRepeats; ++repeat) {
-					complex A = input[0], B = input[stride];
+				complex const *end = input + stride;
+				while (input != end) {
+					for (size_t repeat = 0; repeat < repeats; ++repeat) {
+						complex A = input[0], B = input[stride], C = input[stride*2];
+						complex realSum = A + (B + C)*factor3.real();
+						complex imagSum = (B - C)*factor3.imag();
 
-					output[0] = A + B;
-					output[1] = perf::complexMul<inverse>(A - B, twiddles[1]);
-					++input;
-					output += 2;
+						output[0] = A + B + C;
+						output[repeats] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum, imagSum), twiddles[1]);
+						output[repeats*2] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum, imagSum), twiddles[2]);
+						++input;
+						++output;
+					}
+					twiddles += 3;
+					output += repeats*2;
 				}
-				twiddles += 2;
 			}
-		}
 
-		template<bool inverse>
-		void fftStep3(complex const *input, complex *output, const Step &step) {
-			const complex factor3 = {-0.5, inverse ? 0.8660254037844386 : -0.8660254037844386};
+			template<bool inverse, class Shape>
+			static void fftStep4(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				size_t repeats = shape.repeats;
+				size_t stride = shape.size/4;
 
-			const complex *twiddles = &this->twiddles[step.twiddleOffset];
-			size_t stride = _size/3;
+				complex const *end = input + stride;
+				while (input != end) {
+					for (size_t repeat = 0; repeat < repeats; ++repeat) {
+						complex A = input[0], B = input[stride], C = input[stride*2], D = input[stride*3];
 
-			complex const *end = input + stride;
-			while (input != end) {
-				for (size_t repeat = 0; repeat < step.twiddleRepeats; ++repeat) {
-					complex A = input[0], B = input[stride], C = input[stride*2];
-					complex realSum = A + (B + C)*factor3.real();
-					complex imagSum = (B - C)*factor3.imag();
+						complex sumAC = A + C, sumBD = B + D;
+						complex diffAC = A - C, diffBD = B - D;
 
-					output[0] = A + B + C;
-					output[1] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum, imagSum), twiddles[1]);
-					output[2] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum, imagSum), twiddles[2]);
-					++input;
-					output += 3;
+						output[0] = sumAC + sumBD;
+						output[repeats] = perf::complexMul<inverse>(perf::complexAddI<!inverse>(diffAC, diffBD), twiddles[1]);
+						output[repeats*2] = perf::complexMul<inverse>(sumAC - sumBD, twiddles[2]);
+						output[repeats*3] = perf::complexMul<inverse>(perf::complexAddI<inverse>(diffAC, diffBD), twiddles[3]);
+						++input;
+						++output;
+					}
+					twiddles += 4;
+					output += repeats*3;
 				}
-				twiddles += 3;
 			}
-		}
 
-		template<bool inverse>
-		void fftStep4(complex const *input, complex *output, const Step &step) {
-			const complex *twiddles = &this->twiddles[step.twiddleOffset];
-			size_t stride = _size/4;
+			template<bool inverse, class Shape>
+			static void fftStep5(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				const complex factor5a = {0.30901699437494745, inverse ? 0.9510565162951535 : -0.9510565162951535};
+				const complex factor5b = {-0.8090169943749473, inverse ? 0.5877852522924732 : -0.5877852522924732};
 
-			complex const *end = input + stride;
-			while (input != end) {
-				for (size_t repeat = 0; repeat < step.twiddleRepeats; ++repeat) {
-					complex A = input[0], B = input[stride], C = input[stride*2], D = input[stride*3];
+				size_t repeats = shape.repeats;
+				size_t stride = shape.size/5;
 
-					complex sumAC = A + C, sumBD = B + D;
-					complex diffAC = A - C, diffBD = B - D;
+				complex const *end = input + stride;
+				while (input != end) {
+					for (size_t repeat = 0; repeat < repeats; ++repeat) {
+						complex A = input[0], B = input[stride], C = input[stride*2], D = input[stride*3], E = input[stride*4];
+						complex realSum1 = A + (B + E)*factor5a.real() + (C + D)*factor5b.real();
+						complex imagSum1 = (B - E)*factor5a.imag() + (C - D)*factor5b.imag();
+						complex realSum2 = A + (B + E)*factor5b.real() + (C + D)*factor5a.real();
+						complex imagSum2 = (B - E)*factor5b.imag() + (D - C)*factor5a.imag();
 
-					output[0] = sumAC + sumBD;
-					output[1] = perf::complexMul<inverse>(perf::complexAddI<!inverse>(diffAC, diffBD), twiddles[1]);
-					output[2] = perf::complexMul<inverse>(sumAC - sumBD, twiddles[2]);
-					output[3] = perf::complexMul<inverse>(perf::complexAddI<inverse>(diffAC, diffBD), twiddles[3]);
-					++input;
-					output += 4;
+						output[0] = A + B + C + D + E;
+						output[repeats] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum1, imagSum1), twiddles[1]);
+						output[repeats*2] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum2, imagSum2), twiddles[2]);
+						output[repeats*3] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum2, imagSum2), twiddles[3]);
+						output[repeats*4] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum1, imagSum1), twiddles[4]);
+						++input;
+						++output;
+					}
+					twiddles += 5;
+					output += repeats*4;
 				}
-				twiddles += 4;
 			}
-		}
 
-		template<bool inverse>
-		void fftStep5(complex const *input, complex *output, const Step &step) {
-			const complex factor5a = {0.30901699437494745, inverse ? 0.9510565162951535 : -0.9510565162951535};
-			const complex factor5b = {-0.8090169943749473, inverse ? 0.5877852522924732 : -0.5877852522924732};
+			template<bool inverse, class Shape>
+			static void fftStep7(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				const complex factor7a = {0.6234898018587336, inverse ? 0.7818314824680298 : -0.7818314824680298};
+				const complex factor7b = {-0.22252093395631434, inverse ? 0.9749279121818236 : -0.9749279121818236};
+				const complex factor7c = {-0.900968867902419, inverse ? 0.43388373911755823 : -0.43388373911755823};
 
-			const complex *twiddles = &this->twiddles[step.twiddleOffset];
-			size_t stride = _size/5;
+				size_t repeats = shape.repeats;
+				size_t stride = shape.size/7;
 
-			complex const *end = input + stride;
-			while (input != end) {
-				for (size_t repeat = 0; repeat < step.twiddleRepeats; ++repeat) {
-					complex A = input[0], B = input[stride], C = input[stride*2], D = input[stride*3], E = input[stride*4];
-					complex realSum1 = A + (B + E)*factor5a.real() + (C + D)*factor5b.real();
-					complex imagSum1 = (B - E)*factor5a.imag() + (C - D)*factor5b.imag();
-					complex realSum2 = A + (B + E)*factor5b.real() + (C + D)*factor5a.real();
-					complex imagSum2 = (B - E)*factor5b.imag() + (D - C)*factor5a.imag();
+				complex const *end = input + stride;
+				while (input != end) {
+					for (size_t repeat = 0; repeat < repeats; ++repeat) {
+						complex A = input[0];
+						complex sum1 = input[stride] + input[stride*6], diff1 = input[stride] - input[stride*6];
+						complex sum2 = input[stride*2] + input[stride*5], diff2 = input[stride*2] - input[stride*5];
+						complex sum3 = input[stride*3] + input[stride*4], diff3 = input[stride*3] - input[stride*4];
 
-					output[0] = A + B + C + D + E;
-					output[1] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum1, imagSum1), twiddles[1]);
-					output[2] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum2, imagSum2), twiddles[2]);
-					output[3] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum2, imagSum2), twiddles[3]);
-					output[4] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum1, imagSum1), twiddles[4]);
-					++input;
-					output += 5;
+						complex realSum1 = A + sum1*factor7a.real() + sum2*factor7b.real() + sum3*factor7c.real();
+						complex imagSum1 = diff1*factor7a.imag() + diff2*factor7b.imag() + diff3*factor7c.imag();
+						complex realSum2 = A + sum1*factor7b.real() + sum2*factor7c.real() + sum3*factor7a.real();
+						complex imagSum2 = diff1*factor7b.imag() - diff2*factor7c.imag() - diff3*factor7a.imag();
+						complex realSum3 = A + sum1*factor7c.real() + sum2*factor7a.real() + sum3*factor7b.real();
+						complex imagSum3 = diff1*factor7c.imag() - diff2*factor7a.imag() + diff3*factor7b.imag();
+
+						output[0] = A + sum1 + sum2 + sum3;
+						output[repeats] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum1, imagSum1), twiddles[1]);
+						output[repeats*2] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum2, imagSum2), twiddles[2]);
+						output[repeats*3] = perf::complexMul<inverse>(perf::complexAddI<false>(realSum3, imagSum3), twiddles[3]);
+						output[repeats*4] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum3, imagSum3), twiddles[4]);
+						output[repeats*5] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum2, imagSum2), twiddles[5]);
+						output[repeats*6] = perf::complexMul<inverse>(perf::complexAddI<true>(realSum1, imagSum1), twiddles[6]);
+						++input;
+						++output;
+					}
+					twiddles += 7;
+					output += repeats*6;
 				}
-				twiddles += 5;
 			}
-		}
 
-		template<bool inverse>
-		void run(complex const *input, complex *output) {
-			using std::swap;
+			/* Packed versions of the radix-2/3/4/5 steps, for iterations [from, to).
 
-			const complex *A = input;
-			// Choose the starting state for the ping-pong pattern, so the result ends up in the output
-			bool oddSteps = (plan.size()%2);
-			complex *B = oddSteps ? working.data() : output;
-			complex *other = oddSteps ? output : working.data();
-	
-			// Go through the steps
-			for (const Step& step : plan) {
-				if (step.N == 2) {
-					fftStep2<inverse>(A, B, step);
-				} else if (step.N == 3) {
-					fftStep3<inverse>(A, B, step);
-				} else if (step.N == 4) {
-					fftStep4<inverse>(A, B, step);
-				} else if (step.N == 5) {
-					fftStep5<inverse>(A, B, step);
+			Iteration t = i*repeats + repeat reads input[t + k*stride] and writes output[(i*N + k)*repeats + repeat], so a pack of consecutive iterations loads contiguously.  When the repeats cover the whole pack, it also stores contiguously and shares its twiddles.
+			*/
+			template<class Pack>
+			struct PackedStep {
+				using Split = perf::Split<Pack>;
+				const complex *twiddles;
+				size_t N, repeats;
+
+				SIGNALSMITH_INLINE void store(complex *output, size_t t, size_t bin, const Split &value) const {
+					if (repeats%Pack::lanes == 0) {
+						Pack::storeComplex(output + t + t/repeats*repeats*(N - 1) + bin*repeats, value.re, value.im);
+					} else if (repeats == 1) {
+						Pack::storeStrided(output + t*N + bin, N, value.re, value.im);
+					} else {
+						V re[Pack::lanes], im[Pack::lanes];
+						Pack::store(re, value.re);
+						Pack::store(im, value.im);
+						for (size_t j = 0; j < Pack::lanes; ++j) {
+							size_t tj = t + j;
+							output[tj + tj/repeats*repeats*(N - 1) + bin*repeats] = {re[j], im[j]};
+						}
+					}
+				}
+
+				SIGNALSMITH_INLINE Split twiddle(size_t t, size_t bin) const {
+					if (repeats%Pack::lanes == 0) {
+						const complex &twiddle = twiddles[t/repeats*N + bin];
+						return {Pack::set(twiddle.real()), Pack::set(twiddle.imag())};
+					}
+					V re[Pack::lanes], im[Pack::lanes];
+					for (size_t j = 0; j < Pack::lanes; ++j) {
+						const complex &twiddle = twiddles[(t + j)/repeats*N + bin];
+						re[j] = twiddle.real();
+						im[j] = twiddle.imag();
+					}
+					return {Pack::load(re), Pack::load(im)};
+				}
+			};
+
+			template<bool inverse, class Pack, class Shape>
+			static void fftStep2Packed(complex const *input, complex *output, const complex *twiddles, Shape shape, size_t from, size_t to) {
+				using Split = perf::Split<Pack>;
+				PackedStep<Pack> packed{twiddles, 2, shape.repeats};
+				size_t stride = shape.size/2;
+
+				for (size_t t = from; t < to; t += Pack::lanes) {
+					Split A, B;
+					Pack::loadComplex(input + t, A.re, A.im);
+					Pack::loadComplex(input + t + stride, B.re, B.im);
+
+					Split out0 = A + B;
+					Split out1 = perf::complexMul<inverse>(A - B, packed.twiddle(t, 1));
+					packed.store(output, t, 0, out0);
+					packed.store(output, t, 1, out1);
+				}
+			}
+
+			template<bool inverse, class Pack, class Shape>
+			static void fftStep3Packed(complex const *input, complex *output, const complex *twiddles, Shape shape, size_t from, size_t to) {
+				using Split = perf::Split<Pack>;
+				const typename Pack::Reg factor3Real = Pack::set(-0.5), factor3Imag = Pack::set(inverse ? 0.8660254037844386 : -0.8660254037844386);
+				PackedStep<Pack> packed{twiddles, 3, shape.repeats};
+				size_t stride = shape.size/3;
+
+				for (size_t t = from; t < to; t += Pack::lanes) {
+					Split A, B, C;
+					Pack::loadComplex(input + t, A.re, A.im);
+					Pack::loadComplex(input + t + stride, B.re, B.im);
+					Pack::loadComplex(input + t + stride*2, C.re, C.im);
+					Split realSum = A + (B + C)*factor3Real;
+					Split imagSum = (B - C)*factor3Imag;
+
+					Split out0 = A + B + C;
+					Split out1 = perf::complexMul<inverse>(perf::complexAddI<false>(realSum, imagSum), packed.twiddle(t, 1));
+					Split out2 = perf::complexMul<inverse>(perf::complexAddI<true>(realSum, imagSum), packed.twiddle(t, 2));
+					packed.store(output, t, 0, out0);
+					packed.store(output, t, 1, out1);
+					packed.store(output, t, 2, out2);
+				}
+			}
+
+			template<bool inverse, class Pack, class Shape>
+			static void fftStep4Packed(complex const *input, complex *output, const complex *twiddles, Shape shape, size_t from, size_t to) {
+				using Split = perf::Split<Pack>;
+				PackedStep<Pack> packed{twiddles, 4, shape.repeats};
+				size_t stride = shape.size/4;
+
+				for (size_t t = from; t < to; t += Pack::lanes) {
+					Split A, B, C, D;
+					Pack::loadComplex(input + t, A.re, A.im);
+					Pack::loadComplex(input + t + stride, B.re, B.im);
+					Pack::loadComplex(input + t + stride*2, C.re, C.im);
+					Pack::loadComplex(input + t + stride*3, D.re, D.im);
+					Split sumAC = A + C, sumBD = B + D;
+					Split diffAC = A - C, diffBD = B - D;
+
+					Split out0 = sumAC + sumBD;
+					Split out1 = perf::complexMul<inverse>(perf::complexAddI<!inverse>(diffAC, diffBD), packed.twiddle(t, 1));
+					Split out2 = perf::complexMul<inverse>(sumAC - sumBD, packed.twiddle(t, 2));
+					Split out3 = perf::complexMul<inverse>(perf::complexAddI<inverse>(diffAC, diffBD), packed.twiddle(t, 3));
+					packed.store(output, t, 0, out0);
+					packed.store(output, t, 1, out1);
+					packed.store(output, t, 2, out2);
+					packed.store(output, t, 3, out3);
+				}
+			}
+
+			template<bool inverse, class Pack, class Shape>
+			static void fftStep5Packed(complex const *input, complex *output, const complex *twiddles, Shape shape, size_t from, size_t to) {
+				using Split = perf::Split<Pack>;
+				using Reg = typename Pack::Reg;
+				const Reg factor5aReal = Pack::set(0.30901699437494745), factor5aImag = Pack::set(inverse ? 0.9510565162951535 : -0.9510565162951535);
+				const Reg factor5bReal = Pack::set(-0.8090169943749473), factor5bImag = Pack::set(inverse ? 0.5877852522924732 : -0.5877852522924732);
+				PackedStep<Pack> packed{twiddles, 5, shape.repeats};
+				size_t stride = shape.size/5;
+
+				for (size_t t = from; t < to; t += Pack::lanes) {
+					Split A, B, C, D, E;
+					Pack::loadComplex(input + t, A.re, A.im);
+					Pack::loadComplex(input + t + stride, B.re, B.im);
+					Pack::loadComplex(input + t + stride*2, C.re, C.im);
+					Pack::loadComplex(input + t + stride*3, D.re, D.im);
+					Pack::loadComplex(input + t + stride*4, E.re, E.im);
+					Split realSum1 = A + (B + E)*factor5aReal + (C + D)*factor5bReal;
+					Split imagSum1 = (B - E)*factor5aImag + (C - D)*factor5bImag;
+					Split realSum2 = A + (B + E)*factor5bReal + (C + D)*factor5aReal;
+					Split imagSum2 = (B - E)*factor5bImag + (D - C)*factor5aImag;
+
+					Split out0 = A + B + C + D + E;
+					Split out1 = perf::complexMul<inverse>(perf::complexAddI<false>(realSum1, imagSum1), packed.twiddle(t, 1));
+					Split out2 = perf::complexMul<inverse>(perf::complexAddI<false>(realSum2, imagSum2), packed.twiddle(t, 2));
+					Split out3 = perf::complexMul<inverse>(perf::complexAddI<true>(realSum2, imagSum2), packed.twiddle(t, 3));
+					Split out4 = perf::complexMul<inverse>(perf::complexAddI<true>(realSum1, imagSum1), packed.twiddle(t, 4));
+					packed.store(output, t, 0, out0);
+					packed.store(output, t, 1, out1);
+					packed.store(output, t, 2, out2);
+					packed.store(output, t, 3, out3);
+					packed.store(output, t, 4, out4);
+				}
+			}
+
+			// Runs whole packs with SIMD, and any remaining iterations one at a time
+			template<bool inverse, class Pack, class Shape>
+			static SIGNALSMITH_INLINE bool runPackedStepWith(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				using Scalar = perf::ScalarPack<V>;
+				size_t iterations = shape.size/shape.N;
+				size_t packed = iterations - iterations%Pack::lanes;
+				if (Pack::lanes == 1 || packed == 0) return false;
+				if (shape.N == 2) {
+					fftStep2Packed<inverse, Pack>(input, output, twiddles, shape, 0, packed);
+					fftStep2Packed<inverse, Scalar>(input, output, twiddles, shape, packed, iterations);
+				} else if (shape.N == 3) {
+					fftStep3Packed<inverse, Pack>(input, output, twiddles, shape, 0, packed);
+					fftStep3Packed<inverse, Scalar>(input, output, twiddles, shape, packed, iterations);
+				} else if (shape.N == 4) {
+					fftStep4Packed<inverse, Pack>(input, output, twiddles, shape, 0, packed);
+					fftStep4Packed<inverse, Scalar>(input, output, twiddles, shape, packed, iterations);
+				} else if (shape.N == 5) {
+					fftStep5Packed<inverse, Pack>(input, output, twiddles, shape, 0, packed);
+					fftStep5Packed<inverse, Scalar>(input, output, twiddles, shape, packed, iterations);
 				} else {
-					fftStepGeneric<inverse>(A, B, step);
+					return false;
 				}
-				A = B;
-				swap(B, other);
+				return true;
+			}
+#if defined(SIGNALSMITH_FFT_DISPATCH)
+			template<bool inverse, class Shape>
+			SIGNALSMITH_FFT_TARGET_KERNEL("avx") static bool runPackedStepAvx(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				return runPackedStepWith<inverse, perf::AvxPack<V>>(input, output, twiddles, shape);
+			}
+			template<bool inverse, class Shape>
+			SIGNALSMITH_FFT_TARGET_KERNEL("avx512f") static bool runPackedStepAvx512(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				return runPackedStepWith<inverse, perf::Avx512Pack<V>>(input, output, twiddles, shape);
+			}
+#endif
+			// Widest packs the host supports, or false if there aren't any
+			template<bool inverse, class Shape>
+			static bool runPackedStep(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+#if defined(SIGNALSMITH_FFT_DISPATCH)
+				int level = perf::simdLevel();
+				if (level >= 2) return runPackedStepAvx512<inverse>(input, output, twiddles, shape);
+				if (level >= 1) return runPackedStepAvx<inverse>(input, output, twiddles, shape);
+#endif
+#if defined(SIGNALSMITH_FFT_SSE2)
+				return runPackedStepWith<inverse, perf::Sse2Pack<V>>(input, output, twiddles, shape);
+#else
+				return false;
+#endif
 			}
 
-			// Un-permute the result
-			for (size_t i = 0; i < _size; i++) {
-				B[permutation[i]] = A[i];
+			// Radix-2/3/4/5/7 steps, returning false for anything else
+			template<bool inverse, class Shape>
+			static bool runRadixStep(complex const *input, complex *output, const complex *twiddles, Shape shape) {
+				if (runPackedStep<inverse>(input, output, twiddles, shape)) {
+					// SIMD butterflies
+				} else if (shape.N == 2) {
+					fftStep2<inverse>(input, output, twiddles, shape);
+				} else if (shape.N == 3) {
+					fftStep3<inverse>(input, output, twiddles, shape);
+				} else if (shape.N == 4) {
+					fftStep4<inverse>(input, output, twiddles, shape);
+				} else if (shape.N == 5) {
+					fftStep5<inverse>(input, output, twiddles, shape);
+				} else if (shape.N == 7) {
+					fftStep7<inverse>(input, output, twiddles, shape);
+				} else {
+					return false;
+				}
+				return true;
+			}
+
+			// The inverse uses ifft(x) = conj(fft(conj(x))).  Working space is the chirped signal, its spectrum, then the inner plan's own working.
+			template<bool inverse>
+			void runBluestein(complex const *input, complex *output, complex *working) const {
+				size_t convolutionSize = bluesteinSpectrum.size();
+				complex *buffer = working, *spectrum = working + convolutionSize;
+				for (size_t n = 0; n < _size; ++n) {
+					complex x = inverse ? std::conj(input[n]) : input[n];
+					buffer[n] = perf::complexMul<false>(x, bluesteinChirp[n]);
+				}
+				for (size_t n = _size; n < convolutionSize; ++n) buffer[n] = 0;
+
+				bluesteinPlan->template run<false>(buffer, spectrum, working + 2*convolutionSize);
+				for (size_t i = 0; i < convolutionSize; ++i) {
+					spectrum[i] = perf::complexMul<false>(spectrum[i], bluesteinSpectrum[i]);
+				}
+				bluesteinPlan->template run<true>(spectrum, buffer, working + 2*convolutionSize);
+
+				for (size_t k = 0; k < _size; ++k) {
+					complex y = perf::complexMul<false>(buffer[k], bluesteinChirp[k]);
+					output[k] = inverse ? std::conj(y) : y;
+				}
 			}
-		}
+
+		public:
+			Plan(size_t size) : _size(size) {
+				setPlan();
+			}
+
+			// Shared plan from a process-wide cache, built on first use
+			static std::shared_ptr<const Plan> forSize(size_t size) {
+				static std::mutex mutex;
+				static std::map<size_t, std::shared_ptr<const Plan>> cache;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					auto found = cache.find(size);
+					if (found != cache.end()) return found->second;
+				}
+				// Built outside the lock, since Bluestein plans fetch their own inner plan
+				std::shared_ptr<const Plan> plan(new Plan(size));
+				std::lock_guard<std::mutex> lock(mutex);
+				return cache.emplace(size, plan).first->second;
+			}
+
+			size_t size() const {
+				return _size;
+			}
+			size_t workingSize() const {
+				if (bluesteinPlan) return 2*bluesteinSpectrum.size() + bluesteinPlan->workingSize();
+				return _size;
+			}
+
+			/* Transforms one block of size() values, with working space for workingSize().
+			The output can be the input (but mustn't otherwise overlap it). */
+			template<bool inverse>
+			void run(complex const *input, complex *output, complex *working) const {
+				if (bluesteinPlan) return runBluestein<inverse>(input, output, working);
+				// The ping-pong's first step writes to the output when there's an odd number of steps, so in-place input moves to the working buffer first
+				if (input == output && steps.size()%2) {
+					std::copy(input, input + _size, working);
+					input = working;
+				}
+				UnrolledRun unrolled = inverse ? unrolledInverse : unrolledForward;
+				if (unrolled) return unrolled(input, output, working, twiddles.data());
+				using std::swap;
+
+				if (steps.empty()) {
+					std::copy(input, input + _size, output);
+					return;
+				}
+
+				const complex *A = input;
+				// Choose the starting state for the ping-pong pattern, so the last step writes to the output
+				bool oddSteps = (steps.size()%2);
+				complex *B = oddSteps ? output : working;
+				complex *other = oddSteps ? working : output;
+	
+				// Go through the steps
+				for (const Step& step : steps) {
+					runStep<inverse>(A, B, step);
+					A = B;
+					swap(B, other);
+				}
+			}
+
+		private:
+			template<bool inverse>
+			void runStep(complex const *input, complex *output, const Step &step) const {
+				if (!runRadixStep<inverse>(input, output, &twiddles[step.twiddleOffset], RuntimeShape{step.N, _size, step.twiddleRepeats})) {
+					fftStepGeneric<inverse>(input, output, step);
+				}
+			}
+		};
+
+	private:
+		size_t _size;
+		std::shared_ptr<const Plan> _plan;
+		std::vector<complex> working;
 
 	public:
 		FFT(size_t size) : _size(0) {
@@ -257,14 +1006,119 @@ namespace signalsmith {
 		size_t setSize(size_t size) {
 			if (size != _size) {
 				_size = size;
-				working.resize(size);
-
-				setPlan();
+				_plan = Plan::forSize(size);
+				working.resize(_plan->workingSize());
 			}
 			return _size;
 		}
+		const Plan & plan() const {
+			return *_plan;
+		}
 		const size_t & size() const {
-			return size;
+			return _size;
+		}
+
+		// Smallest size >= `size` with no prime factors above 5, so the plan has no generic steps
+		static size_t fastSizeAbove(size_t size) {
+			size_t best = 1;
+			while (best < size) best *= 2;
+			for (size_t p5 = 1; p5 < best; p5 *= 5) {
+				for (size_t p35 = p5; p35 < best; p35 *= 3) {
+					size_t candidate = p35;
+					while (candidate < size) candidate *= 2;
+					best = std::min(best, candidate);
+				}
+			}
+			return best;
+		}
+
+		void fft(std::vector<complex> const &input, std::vector<complex> &output) {
+			return fft(input.data(), output.data());
+		}
+		// In place if `input == output`
+		void fft(complex const *input, complex *output) {
+			return _plan->template run<false>(input, output, working.data());
+		}
+
+		void ifft(std::vector<complex> const &input, std::vector<complex> &output) {
+			return ifft(input.data(), output.data());
+		}
+		void ifft(complex const *input, complex *output) {
+			return _plan->template run<true>(input, output, working.data());
+		}
+	};
+
+	/* FFT whose size is fixed at compile time.
+
+	The factorisation is resolved by the compiler, so each step is its own instantiation of the radix-2/3/4/5/7 kernels with a constant stride and repeat count, with no per-step dispatch.  Twiddles come from the (shared) runtime plan, whose layout matches, since C++11 can't compute them in a constant expression.
+	Sizes with any other prime factor fall back to the runtime plan.
+	The runtime plan also uses these steps for any sizes listed in SIGNALSMITH_FFT_UNROLLED_SIZES, so FFT and RealFFT can get them at an application's usual frame sizes.
+	*/
+	template<typename V, size_t fixedSize>
+	class FixedFFT {
+		using complex = std::complex<V>;
+		using Plan = typename FFT<V>::Plan;
+
+		// Same choice of step as the runtime plan, for sizes whose prime factors are all <= 7
+		static constexpr size_t stepFactor(size_t size) {
+			return (size%4 == 0) ? 4 : (size%2 == 0) ? 2 : (size%3 == 0) ? 3 : (size%5 == 0) ? 5 : 7;
+		}
+		static constexpr size_t withoutSmallFactors(size_t size) {
+			return (size%2 == 0) ? withoutSmallFactors(size/2)
+				: (size%3 == 0) ? withoutSmallFactors(size/3)
+				: (size%5 == 0) ? withoutSmallFactors(size/5)
+				: (size%7 == 0) ? withoutSmallFactors(size/7)
+				: size;
+		}
+		static constexpr size_t stepCount(size_t size) {
+			return (size <= 1) ? 0 : 1 + stepCount(size/stepFactor(size));
+		}
+
+		template<bool inverse, size_t remaining, bool=(remaining > 1)>
+		struct Steps {
+			static constexpr size_t N = stepFactor(remaining);
+			static void run(complex const *input, complex *output, complex *other, const complex *twiddles) {
+				Plan::template runRadixStep<inverse>(input, output, twiddles, typename Plan::template FixedShape<N, fixedSize, fixedSize/remaining>());
+				Steps<inverse, remaining/N>::run(output, other, output, twiddles + remaining);
+			}
+		};
+		template<bool inverse, size_t remaining>
+		struct Steps<inverse, remaining, false> {
+			static void run(complex const *, complex *, complex *, const complex *) {}
+		};
+
+		std::shared_ptr<const Plan> _plan;
+		std::vector<complex> working;
+
+		// Also used by the runtime plan, for the sizes listed in SIGNALSMITH_FFT_UNROLLED_SIZES
+		friend Plan;
+		template<bool inverse>
+		static void runUnrolled(complex const *input, complex *output, complex *working, const complex *twiddles) {
+			if (fixedSize <= 1) {
+				std::copy(input, input + fixedSize, output);
+				return;
+			}
+			// Ping-pong so the last step writes to the output
+			bool oddSteps = stepCount(fixedSize)%2;
+			complex *B = oddSteps ? output : working;
+			complex *other = oddSteps ? working : output;
+			Steps<inverse, unrolled ? fixedSize : 1>::run(input, B, other, twiddles);
+		}
+
+		template<bool inverse>
+		void run(complex const *input, complex *output) {
+			if (!unrolled) return _plan->template run<inverse>(input, output, working.data());
+			runUnrolled<inverse>(input, output, working.data(), _plan->twiddles.data());
+		}
+
+	public:
+		// Whether the steps are resolved at compile time (otherwise this uses the runtime plan)
+		static constexpr bool unrolled = (withoutSmallFactors(fixedSize) == 1);
+
+		FixedFFT() : _plan(Plan::forSize(fixedSize)), working(_plan->workingSize()) {}
+
+		static constexpr size_t size() {
+			return fixedSize;
 		}
 
 		void fft(std::vector<complex> const &input, std::vector<complex> &output) {
@@ -281,4 +1135,164 @@ namespace signalsmith {
 			return run<true>(input, output);
 		}
 	};
+
+	/* Real-input FFT, producing only the N/2 + 1 non-redundant bins
+
+	Even sizes are computed as a half-size complex FFT (packing even/odd samples into real/imaginary) plus a split step.  Odd sizes fall back to a full-size complex FFT.
+	Single even-size transforms pack into a scratch copy, and the half-size FFT writes straight into the output (which may share memory with the input).
+
+	Like FFT, the inverse is unscaled: ifft(fft(x)) == x*size
+	*/
+	template<typename V>
+	class RealFFT {
+		using complex = std::complex<V>;
+		size_t _size;
+		FFT<V> complexFft, pairFft;
+		std::vector<complex> complexInput, complexOutput;
+		std::shared_ptr<const std::vector<complex>> twiddles;
+
+		size_t complexSize() const {
+			return (_size%2) ? _size : _size/2;
+		}
+		void reserveComplex(size_t size) {
+			if (complexInput.size() < size) {
+				complexInput.resize(size);
+				complexOutput.resize(size);
+			}
+		}
+
+		// Split-step twiddles, shared like FFT plans
+		static std::shared_ptr<const std::vector<complex>> twiddlesForSize(size_t size) {
+			static std::mutex mutex;
+			static std::map<size_t, std::shared_ptr<const std::vector<complex>>> cache;
+			std::lock_guard<std::mutex> lock(mutex);
+			std::shared_ptr<const std::vector<complex>> &cached = cache[size];
+			if (!cached) {
+				std::vector<complex> *twiddles = new std::vector<complex>(size/2 + 1);
+				for (size_t i = 0; i < twiddles->size(); ++i) {
+					double twiddlePhase = 2*M_PI*i/size;
+					(*twiddles)[i] = {(V)cos(twiddlePhase), (V)-sin(twiddlePhase)};
+				}
+				cached.reset(twiddles);
+			}
+			return cached;
+		}
+
+	public:
+		RealFFT(size_t size) : _size(0), complexFft(1), pairFft(1) {
+			this->setSize(size);
+		}
+
+		size_t setSize(size_t size) {
+			if (size != _size) {
+				_size = size;
+				complexFft.setSize(complexSize());
+				reserveComplex(complexSize());
+				twiddles = twiddlesForSize(size);
+			}
+			return _size;
+		}
+		const size_t & size() const {
+			return _size;
+		}
+		size_t bins() const {
+			return _size/2 + 1;
+		}
+
+		void fft(std::vector<V> const &input, std::vector<complex> &output) {
+			return fft(input.data(), output.data());
+		}
+		// The output can share memory with the input
+		void fft(V const *input, complex *output) {
+			if (_size%2) {
+				for (size_t i = 0; i < _size; ++i) complexInput[i] = input[i];
+				complexFft.fft(complexInput.data(), complexOutput.data());
+				for (size_t i = 0; i < bins(); ++i) output[i] = complexOutput[i];
+				return;
+			}
+			size_t halfSize = _size/2;
+			complex *packed = complexInput.data();
+			for (size_t i = 0; i < halfSize; ++i) {
+				packed[i] = {input[2*i], input[2*i + 1]};
+			}
+			complexFft.fft(packed, output);
+
+			// Bins i and halfSize - i both come from the same pair of complex results
+			const complex *twiddles = this->twiddles->data();
+			auto split = [&](complex z, complex zMirror, size_t i) {
+				zMirror = std::conj(zMirror);
+				complex even = (z + zMirror)*(V)0.5;
+				complex odd = (z - zMirror)*(V)0.5;
+				// odd/i, then rotate by the twiddle
+				odd = {odd.imag(), -odd.real()};
+				return even + perf::complexMul<false>(odd, twiddles[i]);
+			};
+			complex z0 = output[0];
+			output[0] = split(z0, z0, 0);
+			output[halfSize] = split(z0, z0, halfSize);
+			for (size_t i = 1; i <= halfSize/2; ++i) {
+				complex z = output[i], zMirror = output[halfSize - i];
+				output[i] = split(z, zMirror, i);
+				output[halfSize - i] = split(zMirror, z, halfSize - i);
+			}
+		}
+
+		/* Spectra of two real signals from a single full-size complex FFT of a + i*b.
+		This matches fft() on each signal up to rounding, which is shared between the two.  Like fft(), each output can share memory with its input. */
+		void fftPair(V const *a, V const *b, complex *outputA, complex *outputB) {
+			pairFft.setSize(_size);
+			reserveComplex(_size);
+			for (size_t i = 0; i < _size; ++i) {
+				complexInput[i] = {a[i], b[i]};
+			}
+			pairFft.fft(complexInput.data(), complexOutput.data());
+
+			for (size_t i = 0; i < bins(); ++i) {
+				complex z = complexOutput[i];
+				complex zMirror = std::conj(complexOutput[(_size - i)%_size]);
+				outputA[i] = (z + zMirror)*(V)0.5;
+				complex diff = (z - zMirror)*(V)0.5;
+				// diff/i
+				outputB[i] = {diff.imag(), -diff.real()};
+			}
+		}
+
+		void ifft(std::vector<complex> const &input, std::vector<V> &output) {
+			return ifft(input.data(), output.data());
+		}
+		// The output can share memory with the input
+		void ifft(complex const *input, V *output) {
+			if (_size%2) {
+				for (size_t i = 0; i < bins(); ++i) complexInput[i] = input[i];
+				for (size_t i = bins(); i < _size; ++i) complexInput[i] = std::conj(input[_size - i]);
+				complexFft.ifft(complexInput.data(), complexOutput.data());
+				for (size_t i = 0; i < _size; ++i) output[i] = complexOutput[i].real();
+				return;
+			}
+			size_t halfSize = _size/2;
+			complex *result = reinterpret_cast<complex *>(output);
+			complex *buffer = complexInput.data();
+			const complex *twiddles = this->twiddles->data();
+			auto merge = [&](complex x, complex xMirror, size_t i) {
+				xMirror = std::conj(xMirror);
+				complex even = x + xMirror;
+				complex odd = perf::complexMul<true>(x - xMirror, twiddles[i]);
+				// even + i*odd
+				return perf::complexAddI<false>(even, odd);
+			};
+			buffer[0] = merge(input[0], input[halfSize], 0);
+			for (size_t i = 1; i <= halfSize/2; ++i) {
+				complex x = input[i], xMirror = input[halfSize - i];
+				buffer[i] = merge(x, xMirror, i);
+				buffer[halfSize - i] = merge(xMirror, x, halfSize - i);
+			}
+			complexFft.ifft(buffer, result);
+		}
+	};
 }
+
+#if defined(SIGNALSMITH_FFT_DISPATCH) && defined(__GNUC__) && !defined(__clang__)
+#	pragma GCC diagnostic pop
+#endif
+
+#endif
@@ -1,10 +1,10 @@
 #include <iostream> // std::cout
+#include <fstream>
 #include <string>
 #include <complex>
 
 #include "lib/wav.h"
 #include "lib/numeric.h"
-#include "lib/fft.h"
 
 #include "shared/console-colours.h"
 #include "shared/simple-args.h"
@@ -28,6 +28,7 @@ int main(int argc, char* argv[]) {
 	std::string speakerFile = args.arg<std::string>("speaker", "WAV file");
 	std::string micFile = args.arg<std::string>("mic", "WAV file");
 	std::string outputWav = args.arg<std::string>("output", "WAV file", "output.wav");
+	std::string impulseFile = args.flag<std::string>("impulse", "write the estimated impulse as raw 32-bit float", "");
 	if (args.error()) return args.help();
 	std::cout << Console::Cyan << micFile << " - " << speakerFile << " -> " << outputWav << Console::Reset << "\n";
 
@@ -42,8 +43,19 @@ int main(int argc, char* argv[]) {
 	// mic.makeMono();
 
 	// Cancel the echo (in-place)
-	EchoCanceller canceller(speaker.sampleRate);
-	canceller.cancel(&speaker.samples[0], speaker.samples.size(), &mic.samples[0], mic.samples.size());
+	std::vector<float> speakerSamples(speaker.samples.size()), micSamples(mic.samples.size());
+	for (size_t i = 0; i < speakerSamples.size(); ++i) speakerSamples[i] = speaker.samples[i];
+	for (size_t i = 0; i < micSamples.size(); ++i) micSamples[i] = mic.samples[i];
+
+	EchoCanceller<> canceller(speaker.sampleRate);
+	canceller.setDiagnostics(!impulseFile.empty());
+	canceller.cancel(speakerSamples.data(), speakerSamples.size(), micSamples.data(), micSamples.size());
+
+	for (size_t i = 0; i < micSamples.size(); ++i) mic.samples[i] = micSamples[i];
+	if (!impulseFile.empty()) {
+		std::ofstream impulseStream(impulseFile, std::ios::binary);
+		impulseStream.write((const char *)canceller.impulse().data(), canceller.impulse().size()*sizeof(float));
+	}
 
 	mic.write(outputWav);
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 
 #include "echo-canceller.h"
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
 
 void log(const Napi::Env env, const std::vector<std::string> msgs) {
     auto lg = env.Global().Get("console").As<Napi::Object>().Get("log").As<Napi::Function>();
@@ -12,11 +16,141 @@ void log(const Napi::Env env, const std::vector<std::string> msgs) {
     lg.Call(ags);
 }
 
-Napi::Number cancel(const Napi::CallbackInfo& info) {
+// Reads the options object (sampleRate defaults to 44.1kHz) - done on the main thread, before any work is queued
+EchoCancellerConfig configOptions(const Napi::CallbackInfo& info, size_t index) {
+    double sampleRate = 44100;
+    Napi::Object options;
+    bool hasOptions = info.Length() > index && info[index].IsObject();
+    if (hasOptions) {
+        options = info[index].As<Napi::Object>();
+        if (options.Has("sampleRate")) {
+            sampleRate = options.Get("sampleRate").As<Napi::Number>().DoubleValue();
+        }
+    }
+    EchoCancellerConfig config(sampleRate);
+    if (!hasOptions) return config;
+
+    // Applied first, so the individual options below override it
+    if (options.Has("preset")) {
+        std::string preset = options.Get("preset").As<Napi::String>();
+        if (preset == "fast") {
+            config.setPreset(EchoCancellerConfig::Preset::fast);
+        } else if (preset == "balanced") {
+            config.setPreset(EchoCancellerConfig::Preset::balanced);
+        } else if (preset == "best") {
+            config.setPreset(EchoCancellerConfig::Preset::best);
+        }
+    }
+    if (options.Has("spectrumCache")) {
+        std::string spectrumCache = options.Get("spectrumCache").As<Napi::String>();
+        if (spectrumCache == "memory") {
+            config.setSpectrumCache(EchoCancellerConfig::SpectrumCache::memory);
+        } else if (spectrumCache == "file") {
+            config.setSpectrumCache(EchoCancellerConfig::SpectrumCache::file);
+        }
+    }
+    if (options.Has("speakerCache")) {
+        config.setSpeakerCache(options.Get("speakerCache").As<Napi::String>());
+    }
+    if (options.Has("threads")) {
+        config.setThreads(options.Get("threads").As<Napi::Number>().Uint32Value());
+    }
+    if (options.Has("diagnostics")) {
+        config.setDiagnostics(options.Get("diagnostics").ToBoolean());
+    }
+    if (options.Has("autoImpulseLength")) {
+        config.setAutoImpulseLength(options.Get("autoImpulseLength").ToBoolean());
+    }
+    if (options.Has("driftCompensation")) {
+        config.setDriftCompensation(options.Get("driftCompensation").ToBoolean());
+    }
+    if (options.Has("suppressionStrength")) {
+        config.setSuppressionStrength(options.Get("suppressionStrength").As<Napi::Number>().DoubleValue());
+    }
+    if (options.Has("precision")) {
+        std::string precision = options.Get("precision").As<Napi::String>();
+        config.setSinglePrecision(precision == "single");
+    }
+    return config;
+}
+
+// What cancel() found, copied out so the canceller itself doesn't outlive the work
+struct CancelOutcome {
+    int offset = 0;
+    double drift = 0;
+    std::vector<float> impulse;
+};
+
+// Float and double cancellers for one set of options.  These keep their FFT plans and buffers between takes, so only one take runs at a time.
+class SharedCanceller {
+    EchoCancellerConfig config;
+    EchoCanceller<float> singleCanceller;
+    EchoCanceller<double> doubleCanceller;
+    std::mutex mutex;
+
+    template<typename Sample>
+    static CancelOutcome run(EchoCanceller<Sample> &canceller, float *referenceData, size_t refLength, float *recordedData, size_t recLength) {
+        CancelOutcome outcome;
+        outcome.offset = canceller.cancel(referenceData, refLength, recordedData, recLength);
+        outcome.drift = canceller.drift();
+        outcome.impulse = canceller.impulse();
+        return outcome;
+    }
+
+    // Picks the float or double canceller from the "precision" option - call with the mutex held
+    CancelOutcome runLocked(float *referenceData, size_t refLength, float *recordedData, size_t recLength) {
+        if (config.isSinglePrecision()) {
+            return run(singleCanceller, referenceData, refLength, recordedData, recLength);
+        }
+        return run(doubleCanceller, referenceData, refLength, recordedData, recLength);
+    }
+
+public:
+    SharedCanceller(const EchoCancellerConfig &config) : config(config), singleCanceller(config), doubleCanceller(config) {}
+
+    double sampleRate() const {
+        return config.getSampleRate();
+    }
+
+    // Waits for any other take on these cancellers, so the main thread should use tryCancel() on a shared one
+    CancelOutcome cancel(float *referenceData, size_t refLength, float *recordedData, size_t recLength) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return runLocked(referenceData, refLength, recordedData, recLength);
+    }
+
+    // Returns false without waiting if another take is running
+    bool tryCancel(float *referenceData, size_t refLength, float *recordedData, size_t recLength, CancelOutcome &outcome) {
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return false;
+        outcome = runLocked(referenceData, refLength, recordedData, recLength);
+        return true;
+    }
+};
+
+// The offset in seconds, or with the "diagnostics" option, {offset, impulse, drift} where impulse is a Float32Array and drift is in ppm
+Napi::Value cancelResult(Napi::Env env, double sampleRate, const CancelOutcome &outcome) {
+    int offset = outcome.offset;
+    log(env, {"Got offset of", std::to_string(offset), "samples (that's", std::to_string(offset/sampleRate), "s)"});
+    if (outcome.drift != 0) {
+        log(env, {"Compensated for clock drift of", std::to_string(outcome.drift), "ppm"});
+    }
+
+    auto seconds = Napi::Number::New(env, -offset / sampleRate);
+    if (outcome.impulse.empty()) return seconds;
+
+    auto impulse = Napi::Float32Array::New(env, outcome.impulse.size());
+    std::copy(outcome.impulse.begin(), outcome.impulse.end(), impulse.Data());
+    auto result = Napi::Object::New(env);
+    result.Set("offset", seconds);
+    result.Set("impulse", impulse);
+    result.Set("drift", Napi::Number::New(env, outcome.drift));
+    return result;
+}
+
+Napi::Value cancel(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     auto referenceAudio = info[0].As<Napi::ArrayBuffer>();
     auto recordedAudio = info[1].As<Napi::ArrayBuffer>();
-    auto itemId = info[2].As<Napi::String>();
 
     float* referenceData = (float*)referenceAudio.Data();
     float* recordedData = (float*)recordedAudio.Data();
@@ -25,18 +159,200 @@ Napi::Number cancel(const Napi::CallbackInfo& info) {
 
     log(env, {"Cancelling", std::to_string(recLength), "samples of recorded audio"});
 
-    EchoCanceller canceller(44100);
-	auto offset = canceller.cancel(referenceData, refLength, recordedData, recLength, std::string(itemId));
+    SharedCanceller canceller(configOptions(info, 2));
+    auto outcome = canceller.cancel(referenceData, refLength, recordedData, recLength);
+
+    return cancelResult(env, canceller.sampleRate(), outcome);
+}
 
-    log(env, {"Got offset of", std::to_string(offset), "samples (that's", std::to_string(offset/44100.0), "ms)"});
+// Runs cancel() on the libuv thread pool, holding references to the ArrayBuffers until it's done
+class CancelWorker : public Napi::AsyncWorker {
+    Napi::Promise::Deferred deferred;
+    Napi::ObjectReference referenceAudio, recordedAudio;
+    float *referenceData, *recordedData;
+    size_t refLength, recLength;
+    std::shared_ptr<SharedCanceller> canceller;
+    CancelOutcome outcome;
+
+public:
+    CancelWorker(const Napi::CallbackInfo& info, std::shared_ptr<SharedCanceller> canceller) : Napi::AsyncWorker(info.Env()), deferred(Napi::Promise::Deferred::New(info.Env())), canceller(canceller) {
+        auto referenceBuffer = info[0].As<Napi::ArrayBuffer>();
+        auto recordedBuffer = info[1].As<Napi::ArrayBuffer>();
+        referenceAudio = Napi::Persistent(referenceBuffer.As<Napi::Object>());
+        recordedAudio = Napi::Persistent(recordedBuffer.As<Napi::Object>());
+        referenceData = (float*)referenceBuffer.Data();
+        recordedData = (float*)recordedBuffer.Data();
+        refLength = referenceBuffer.ByteLength() / 4;
+        recLength = recordedBuffer.ByteLength() / 4;
+    }
+
+    Napi::Promise promise() {
+        return deferred.Promise();
+    }
 
-    return Napi::Number::New(env, -offset / 44100.0); // Return the offset in seconds
+protected:
+    void Execute() override {
+        outcome = canceller->cancel(referenceData, refLength, recordedData, recLength);
+    }
+
+    void OnOK() override {
+        deferred.Resolve(cancelResult(Env(), canceller->sampleRate(), outcome));
+    }
+
+    void OnError(const Napi::Error& error) override {
+        deferred.Reject(error.Value());
+    }
+};
+
+// Same arguments as cancel(), but returns a Promise of its result.  The buffers mustn't be touched until it resolves.
+Napi::Value cancelAsync(const Napi::CallbackInfo& info) {
+    auto recLength = info[1].As<Napi::ArrayBuffer>().ByteLength() / 4;
+    log(info.Env(), {"Cancelling", std::to_string(recLength), "samples of recorded audio (async)"});
+
+    auto worker = new CancelWorker(info, std::make_shared<SharedCanceller>(configOptions(info, 2)));
+    auto promise = worker->promise();
+    worker->Queue(); // deletes itself when complete
+    return promise;
 }
 
+// A canceller to reuse across takes: new Canceller(options), then cancel(reference, recorded) or cancelAsync(reference, recorded), as above.
+// Its options are fixed when it's created, and takes queued on the same Canceller run one after another.
+// cancel() throws rather than blocking the event loop if a cancelAsync() take is still running.
+class Canceller : public Napi::ObjectWrap<Canceller> {
+    // Shared with any queued workers, so it outlives this object if they're still running
+    std::shared_ptr<SharedCanceller> canceller;
+
+public:
+    static Napi::Function Define(Napi::Env env) {
+        return DefineClass(env, "Canceller", {
+            InstanceMethod("cancel", &Canceller::cancel),
+            InstanceMethod("cancelAsync", &Canceller::cancelAsync),
+        });
+    }
+
+    Canceller(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Canceller>(info), canceller(std::make_shared<SharedCanceller>(configOptions(info, 0))) {}
+
+    Napi::Value cancel(const Napi::CallbackInfo& info) {
+        auto referenceAudio = info[0].As<Napi::ArrayBuffer>();
+        auto recordedAudio = info[1].As<Napi::ArrayBuffer>();
+        CancelOutcome outcome;
+        if (!canceller->tryCancel((float*)referenceAudio.Data(), referenceAudio.ByteLength() / 4, (float*)recordedAudio.Data(), recordedAudio.ByteLength() / 4, outcome)) {
+            Napi::Error::New(info.Env(), "Canceller is busy with cancelAsync() - wait for it, or use cancelAsync()").ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+        return cancelResult(info.Env(), canceller->sampleRate(), outcome);
+    }
+
+    Napi::Value cancelAsync(const Napi::CallbackInfo& info) {
+        auto worker = new CancelWorker(info, canceller);
+        auto promise = worker->promise();
+        worker->Queue();
+        return promise;
+    }
+};
+
+// Block-based cancellation: new Stream(options), then write(reference, recorded) with paired Float32Arrays, and finish() at the end.
+// Both return a Float32Array of whatever cancelled audio is ready.
+class Stream : public Napi::ObjectWrap<Stream> {
+    EchoCanceller<> canceller;
+    EchoCanceller<>::Stream stream;
+
+    Napi::Value readAvailable(Napi::Env env) {
+        auto output = Napi::Float32Array::New(env, stream.available());
+        stream.read(output.Data(), output.ElementLength());
+        return output;
+    }
+
+public:
+    static Napi::Function Define(Napi::Env env) {
+        return DefineClass(env, "Stream", {
+            InstanceMethod("write", &Stream::write),
+            InstanceMethod("finish", &Stream::finish),
+            InstanceMethod("offset", &Stream::offset),
+        });
+    }
 
+    Stream(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Stream>(info), canceller(configOptions(info, 0)), stream(canceller) {}
+
+    Napi::Value write(const Napi::CallbackInfo& info) {
+        auto referenceAudio = info[0].As<Napi::Float32Array>();
+        auto recordedAudio = info[1].As<Napi::Float32Array>();
+        stream.write(referenceAudio.Data(), recordedAudio.Data(), std::min(referenceAudio.ElementLength(), recordedAudio.ElementLength()));
+        return readAvailable(info.Env());
+    }
+
+    Napi::Value finish(const Napi::CallbackInfo& info) {
+        stream.finish();
+        return readAvailable(info.Env());
+    }
+
+    Napi::Value offset(const Napi::CallbackInfo& info) {
+        return Napi::Number::New(info.Env(), -stream.offsetSamples() / canceller.getSampleRate()); // Offset in seconds, as returned by cancel()
+    }
+};
+
+double numberOption(const Napi::CallbackInfo& info, size_t index, const char *name, double defaultValue) {
+    if (info.Length() > index && info[index].IsObject()) {
+        auto options = info[index].As<Napi::Object>();
+        if (options.Has(name)) return options.Get(name).As<Napi::Number>().DoubleValue();
+    }
+    return defaultValue;
+}
+
+// Real-time cancellation: new LiveCanceller({sampleRate, blockSize, filterMs}), then process(reference, recorded) with paired Float32Arrays.
+// Returns a Float32Array of cancelled audio, the same length as the input but delayed by latency() samples.
+class LiveCanceller : public Napi::ObjectWrap<LiveCanceller> {
+    // Only created once the options are known to be valid
+    std::unique_ptr<EchoCanceller<float>::Live> live;
+
+public:
+    static Napi::Function Define(Napi::Env env) {
+        return DefineClass(env, "LiveCanceller", {
+            InstanceMethod("process", &LiveCanceller::process),
+            InstanceMethod("latency", &LiveCanceller::latency),
+        });
+    }
+
+    LiveCanceller(const Napi::CallbackInfo& info) : Napi::ObjectWrap<LiveCanceller>(info) {
+        double sampleRate = numberOption(info, 0, "sampleRate", 44100);
+        double blockSize = numberOption(info, 0, "blockSize", 256);
+        double filterMs = numberOption(info, 0, "filterMs", 250);
+        // Written so NaN fails too, since it (or a negative value) would wrap around when converted to a size
+        if (!(sampleRate > 0 && sampleRate <= 1e6)) {
+            Napi::RangeError::New(info.Env(), "sampleRate must be between 0 and 1000000").ThrowAsJavaScriptException();
+            return;
+        }
+        if (!(blockSize >= 1 && blockSize <= 65536) || blockSize != std::floor(blockSize)) {
+            Napi::RangeError::New(info.Env(), "blockSize must be a whole number from 1 to 65536").ThrowAsJavaScriptException();
+            return;
+        }
+        if (!(filterMs >= 0 && filterMs <= 10000)) {
+            Napi::RangeError::New(info.Env(), "filterMs must be from 0 to 10000").ThrowAsJavaScriptException();
+            return;
+        }
+        live.reset(new EchoCanceller<float>::Live(sampleRate, (size_t)blockSize, filterMs));
+    }
+
+    Napi::Value process(const Napi::CallbackInfo& info) {
+        auto referenceAudio = info[0].As<Napi::Float32Array>();
+        auto recordedAudio = info[1].As<Napi::Float32Array>();
+        size_t length = std::min(referenceAudio.ElementLength(), recordedAudio.ElementLength());
+        auto output = Napi::Float32Array::New(info.Env(), length);
+        live->process(referenceAudio.Data(), recordedAudio.Data(), output.Data(), length);
+        return output;
+    }
+
+    Napi::Value latency(const Napi::CallbackInfo& info) {
+        return Napi::Number::New(info.Env(), live->latency());
+    }
+};
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
   exports.Set(Napi::String::New(env, "cancel"), Napi::Function::New(env, cancel));
+  exports.Set(Napi::String::New(env, "cancelAsync"), Napi::Function::New(env, cancelAsync));
+  exports.Set(Napi::String::New(env, "Canceller"), Canceller::Define(env));
+  exports.Set(Napi::String::New(env, "Stream"), Stream::Define(env));
+  exports.Set(Napi::String::New(env, "LiveCanceller"), LiveCanceller::Define(env));
               
   return exports;
 }
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <vector>
+#include <complex>
+#include <random>
+#include <cmath>
+
+// The canceller's sizes, so both the runtime and the compile-time steps are checked
+#define SIGNALSMITH_FFT_UNROLLED_SIZES 4410, 2205, 44100, 22050, 4800, 2400, 48000, 24000
+#include "lib/fft.h"
+
+#include "shared/console-colours.h"
+
+// Largest difference from a direct DFT (checking the first few bins) and from the input after a round trip, relative to the RMS input
+template<typename V>
+struct ErrorCheck {
+	using complex = std::complex<V>;
+	std::vector<complex> input;
+
+	ErrorCheck(size_t size) : input(size) {
+		std::mt19937 rng(size);
+		std::uniform_real_distribution<double> dist(-1, 1);
+		for (auto &v : input) v = {(V)dist(rng), (V)dist(rng)};
+	}
+
+	double spectrum(const std::vector<complex> &output, size_t maxBins=16) const {
+		size_t size = input.size();
+		double error = 0;
+		for (size_t k = 0; k < std::min(output.size(), maxBins); ++k) {
+			std::complex<double> sum = 0;
+			for (size_t i = 0; i < size; ++i) {
+				sum += std::complex<double>(input[i])*std::polar(1.0, -2*M_PI*(double)((i*k)%size)/size);
+			}
+			error = std::max(error, std::abs(sum - std::complex<double>(output[k]))/std::sqrt((double)size));
+		}
+		return error;
+	}
+
+	double roundTrip(const std::vector<complex> &result) const {
+		double error = 0;
+		for (size_t i = 0; i < input.size(); ++i) {
+			error = std::max(error, std::abs(std::complex<double>(result[i])/(double)input.size() - std::complex<double>(input[i])));
+		}
+		return error;
+	}
+};
+
+int failures = 0;
+
+void report(const char *name, size_t size, double error, double limit) {
+	if (error <= limit) return;
+	++failures;
+	std::cout << Console::Red << name << " size " << size << ": error " << error << Console::Reset << "\n";
+}
+
+template<typename V>
+void testComplex(size_t size, double limit) {
+	using complex = std::complex<V>;
+	signalsmith::FFT<V> fft(size);
+	ErrorCheck<V> check(size);
+
+	std::vector<complex> output(size), result(size);
+	fft.fft(check.input, output);
+	report("fft", size, check.spectrum(output), limit);
+	fft.ifft(output, result);
+	report("ifft", size, check.roundTrip(result), limit);
+
+	std::vector<complex> inPlace = check.input;
+	fft.fft(inPlace, inPlace);
+	report("in-place fft", size, check.spectrum(inPlace), limit);
+	fft.ifft(inPlace, inPlace);
+	report("in-place ifft", size, check.roundTrip(inPlace), limit);
+}
+
+template<typename V>
+void testReal(size_t size, double limit) {
+	using complex = std::complex<V>;
+	signalsmith::RealFFT<V> fft(size);
+	ErrorCheck<V> check(size);
+	std::vector<V> input(size), result(size);
+	for (size_t i = 0; i < size; ++i) check.input[i] = input[i] = check.input[i].real();
+	auto roundTrip = [&](const V *result) {
+		double error = 0;
+		for (size_t i = 0; i < size; ++i) error = std::max(error, std::abs((double)result[i]/size - input[i]));
+		return error;
+	};
+
+	std::vector<complex> output(fft.bins());
+	fft.fft(input.data(), output.data());
+	report("real fft", size, check.spectrum(output), limit);
+	fft.ifft(output.data(), result.data());
+	report("real ifft", size, roundTrip(result.data()), limit);
+
+	// The samples fit in the spectrum's memory
+	std::vector<complex> inPlace(fft.bins());
+	V *samples = reinterpret_cast<V *>(inPlace.data());
+	std::copy(input.begin(), input.end(), samples);
+	fft.fft(samples, inPlace.data());
+	report("in-place real fft", size, check.spectrum(inPlace), limit);
+	fft.ifft(inPlace.data(), samples);
+	report("in-place real ifft", size, roundTrip(samples), limit);
+
+	// Pairs match separate transforms, in place or not
+	std::vector<V> other(size);
+	for (size_t i = 0; i < size; ++i) other[i] = check.input[(i*7 + 3)%size].real();
+	std::vector<complex> otherOutput(fft.bins()), pairA(fft.bins()), pairB(fft.bins());
+	fft.fft(other.data(), otherOutput.data());
+	auto pairError = [&](const std::vector<complex> &a, const std::vector<complex> &b) {
+		double error = 0;
+		for (size_t i = 0; i < fft.bins(); ++i) {
+			error = std::max(error, (double)std::abs(a[i] - output[i])/std::sqrt((double)size));
+			error = std::max(error, (double)std::abs(b[i] - otherOutput[i])/std::sqrt((double)size));
+		}
+		return error;
+	};
+	fft.fftPair(input.data(), other.data(), pairA.data(), pairB.data());
+	report("real fft pair", size, pairError(pairA, pairB), limit);
+	V *samplesB = reinterpret_cast<V *>(pairB.data());
+	std::copy(input.begin(), input.end(), reinterpret_cast<V *>(pairA.data()));
+	std::copy(other.begin(), other.end(), samplesB);
+	fft.fftPair(reinterpret_cast<V *>(pairA.data()), samplesB, pairA.data(), pairB.data());
+	report("in-place real fft pair", size, pairError(pairA, pairB), limit);
+}
+
+int main() {
+	std::vector<size_t> sizes;
+	for (size_t size = 1; size <= 128; ++size) sizes.push_back(size);
+	// Common frame sizes, generic-step and Bluestein primes, and a repeated prime above the generic-step limit
+	for (size_t size : {2205, 2400, 4410, 4800, 44100, 48000, 551, 1009, 20677, 131*131, 131*131*256}) {
+		sizes.push_back(size);
+	}
+
+	for (size_t size : sizes) {
+		testComplex<double>(size, 1e-12);
+		testComplex<float>(size, 1e-4);
+	}
+	for (size_t size : {2, 3, 16, 17, 100, 2205, 4410, 4800, 48000, 131*131*2}) {
+		testReal<double>(size, 1e-12);
+		testReal<float>(size, 1e-4);
+	}
+
+	if (failures) {
+		std::cout << Console::Red << failures << " FFT checks failed" << Console::Reset << "\n";
+		return 1;
+	}
+	std::cout << Console::Green << "FFT checks passed" << Console::Reset << "\n";
+	return 0;
+}
@@ -4,6 +4,9 @@ Peer.prototype.getTransceiver = function(id) {
     return this._pc.getTransceivers()[RTCTransceivers.indexOf(id)];
 }
 
+// Sample rate of all recorded and reference audio. The server and the native addons take it as a parameter.
+export const AUDIO_SAMPLE_RATE = 44100;
+
 export const RTCTransceivers = [
     'my-video',
     'my-audio',